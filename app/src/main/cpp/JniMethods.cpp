@@ -3,6 +3,7 @@
 #include <thread>
 #include <queue>
 #include <future>
+#include <algorithm>
 #ifndef LOG_TAG
 #define LOG_TAG "jniComm"
 #endif
@@ -10,19 +11,25 @@
 #include <time/TimeStamp.h>
 #include <Scadup/Scadup.h>
 #include <message/Message.h>
+#include <message/PublisherPool.h>
+#include <message/PublishBatcher.h>
 #include <files/FileUtils.h>
 #include <network/KcpEmulator.h>
 #include <gles/EglShader.h>
 #include <gles/EglTexture.h>
 #include <gles/EglGpuRender.h>
 #include <gles/CpuRenderView.h>
+#include <gles/FrameRing.h>
+#include <gles/FrameRenderer.h>
 #include <files/bitmap.h>
 #include "../jni/jniInc.h"
 #include "callback/JavaFuncCalls.h"
+#include "callback/JniRegistry.h"
+#include "callback/JniString.h"
 
 extern JavaVM *g_jniJVM;
+extern jclass g_jniCls;
 extern std::string g_className;
-extern std::string Jstring2Cstring(JNIEnv *env, jstring jstr);
 extern void SetTextView(JNIEnv *env, jclass thiz, const std::string& viewId, const std::string& text);
 extern void SetActivityViewText(JNIEnv *env, int viewId, const char* text);
 namespace {
@@ -35,9 +42,12 @@ JNIEXPORT void CPP_FUNC_CALL(initJvmEnv)(JNIEnv *env, jclass, jstring class_name
 {
     int state = env->GetJavaVM(&g_jniJVM);
     g_className =
-            // Jstring2Cstring(env, getPackageName(env))
+            // JniString(env, getPackageName(env)).str()
             // + "." +
-            Jstring2Cstring(env, class_name);
+            JniString(env, class_name).str();
+    std::string name = g_className;
+    std::replace(name.begin(), name.end(), '.', '/');
+    g_jniCls = JniRegistry::instance().SetCallbackClass(env, name);
     LOGI("class_name = %s, state = %d.", g_className.c_str(), state);
 }
 
@@ -59,14 +69,12 @@ JNIEXPORT jstring CPP_FUNC_CALL(stringGetJNI)(
 
 JNIEXPORT jobject CPP_FUNC_CALL(getMessage)(JNIEnv *env, jobject, jobject clazz)
 {
+    JniRegistry &registry = JniRegistry::instance();
     Messaging receiving = Message::instance().getMessage();
     if (!receiving.message.empty()) {
-        jclass objectClass = env->FindClass("com/tsymiar/devidroid/data/Receiver");
-        jfieldID value = (env)->GetFieldID(objectClass, "message", "Ljava/lang/String;");
-        jfieldID key = (env)->GetFieldID(objectClass, "receiver", "I");
         jstring msg = env->NewStringUTF(receiving.message.c_str());
-        env->SetObjectField(clazz, value, msg);
-        env->SetIntField(clazz, key, (int) receiving.massager);
+        env->SetObjectField(clazz, registry.receiverMessage, msg);
+        env->SetIntField(clazz, registry.receiverWhat, (int) receiving.massager);
         LOGI("message pop [%d], %s", receiving.massager, receiving.message.c_str());
         env->DeleteLocalRef(msg);
         return clazz;
@@ -75,6 +83,47 @@ JNIEXPORT jobject CPP_FUNC_CALL(getMessage)(JNIEnv *env, jobject, jobject clazz)
     }
 }
 
+JNIEXPORT jint CPP_FUNC_CALL(drainMessages)(JNIEnv *env, jobject, jobject buffer, jint max)
+{
+    auto *address = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (address == nullptr || capacity <= 0 || max <= 0) {
+        return -1;
+    }
+    return static_cast<jint>(Message::instance().drainMessages(address, static_cast<size_t>(capacity),
+                                                               static_cast<size_t>(max)));
+}
+
+JNIEXPORT jboolean CPP_FUNC_CALL(waitMessages)(JNIEnv *, jobject, jint timeoutMs)
+{
+    return static_cast<jboolean>(Message::instance().waitMessages(timeoutMs));
+}
+
+JNIEXPORT void CPP_FUNC_CALL(messageBenchmark)(JNIEnv *, jclass, jint rounds)
+{
+    std::thread th(
+            [](int rounds) -> void {
+                Message::WakeBenchmark(rounds > 0 ? rounds : 1000);
+                Message::PayloadBenchmark();
+                // multi-producer stress, once per overflow policy
+                for (MessageOverflow overflow : {DROP_OLDEST, DROP_NEWEST, BLOCK_PRODUCER}) {
+                    Message::Benchmark(8, 100000, overflow);
+                }
+                Message::instance().setMessage("Message benchmark finish.", TOAST);
+            }, rounds);
+    if (th.joinable())
+        th.detach();
+}
+
+JNIEXPORT void CPP_FUNC_CALL(jniBenchmark)(JNIEnv *env, jclass, jint rounds)
+{
+    // lookups are per env, so this one runs on the calling java thread
+    JniRegistry::Benchmark(env, rounds > 0 ? rounds : 10000);
+    JniString::Benchmark(env, rounds > 0 ? rounds : 10000);
+    JavaFuncCalls::Benchmark(4, rounds > 0 ? rounds : 10000);
+    Message::instance().setMessage("Jni benchmark finish.", TOAST);
+}
+
 JNIEXPORT jlong CPP_FUNC_CALL(timeSetJNI)(JNIEnv *env, jobject, jbyteArray time, jint len)
 {
     auto *byte = (unsigned char *) env->GetByteArrayElements(time, nullptr);
@@ -107,25 +156,27 @@ struct PubSubParam {
 } g_pubSubParam;
 
 void RecvHook(const Scadup::Message& msg) {
-    std::string message = "header:\t[" + std::string(msg.header.topic)
-                          + "]\npayload:\t[" + msg.payload.status
-                          + "]\t[" + msg.payload.content + "].";
-    Message::instance().setMessage(message, MESSAGE);
+    // a batch packed by PublishBatcher is its messages joined by '\n', each is shown on its own
+    const char *content = msg.payload.content;
+    do {
+        const char *end = strchr(content, '\n');
+        int length = static_cast<int>(end != nullptr ? end - content : strlen(content));
+        Message::instance().formatMessage(MESSAGE, "header:\t[%s]\npayload:\t[%s]\t[%.*s].",
+                                          msg.header.topic, msg.payload.status, length, content);
+        content = end != nullptr ? end + 1 : nullptr;
+    } while (content != nullptr);
     // SetActivityViewText(&g_pubSubParam.env, g_pubSubParam.id, msg.payload.content);
 }
 
 JNIEXPORT jint CPP_FUNC_CALL(StartSubscribe)(JNIEnv *env, jclass clz , jstring addr, jint port, jstring topic, jstring viewId, jint id) {
     jint status = -1;
-    std::string address = Jstring2Cstring(env, addr);
-    g_pubSubParam.addr = address;
-    const std::string msg = Jstring2Cstring(env, topic);
-    g_pubSubParam.topic = msg;
+    g_pubSubParam.addr = JniString(env, addr).str();
+    g_pubSubParam.topic = JniString(env, topic).str();
     g_pubSubParam.port = port;
     g_pubSubParam.hook = RecvHook;
     g_pubSubParam.env = *env;
     g_pubSubParam.clz = clz;
-    const std::string view = Jstring2Cstring(env, viewId);
-    g_pubSubParam.view = view;
+    g_pubSubParam.view = JniString(env, viewId).str();
     g_pubSubParam.id = id;
     std::thread th(
             [&status](const PubSubParam& param) -> void {
@@ -154,36 +205,61 @@ JNIEXPORT void CPP_FUNC_CALL(Publish)(JNIEnv *env, jclass , jstring topic, jstri
         LOGI("g_pubSubParam: addr is null or port == 0.");
         return;
     }
-    std::string topicParam = Jstring2Cstring(env, topic);
-    std::string payloadParam = Jstring2Cstring(env, payload);
-    Scadup Scadup;
-    Scadup.Initialize(g_pubSubParam.addr.c_str(), g_pubSubParam.port);
-    ssize_t stat = Scadup.Publisher(topicParam, payloadParam);
-    if (stat < 0) {
-        Message::instance().setMessage("Message Publisher failed!", TOAST);
+    JniString topicParam(env, topic);
+    JniString payloadParam(env, payload);
+    // batched per topic, then queued onto a warm broker connection; failures are reported by the pool
+    if (!PublishBatcher::instance().Publish(g_pubSubParam.addr, g_pubSubParam.port,
+                                            topicParam.str(), payloadParam.str())) {
+        Message::instance().setMessage("Message Publisher queue full!", TOAST);
     }
-    LOGI("Publish(%ld) to [%s:%d]: message: [%s][%s].", stat,
+    LOGI("Publish to [%s:%d]: message: [%s][%s].",
          g_pubSubParam.addr.c_str(), g_pubSubParam.port,
          topicParam.c_str(), payloadParam.c_str());
 }
 
-int callback(const char *c, int i)
+JNIEXPORT void CPP_FUNC_CALL(publishBenchmark)(JNIEnv *, jclass, jint count)
+{
+    if (g_pubSubParam.addr.empty() || g_pubSubParam.port == 0) {
+        Message::instance().setMessage("confirm subscribe first", TOAST);
+        return;
+    }
+    std::thread th(
+            [](std::string addr, int port, int count) -> void {
+                PublisherPool::Benchmark(addr, port, count > 0 ? count : 1000);
+                PublishBatcher::Benchmark(addr, port, count > 0 ? count * 10 : 10000);
+                Message::instance().setMessage("Publish benchmark finish.", TOAST);
+            }, g_pubSubParam.addr, g_pubSubParam.port, count);
+    if (th.joinable())
+        th.detach();
+}
+
+JNIEXPORT void CPP_FUNC_CALL(setPublishBatching)(JNIEnv *, jclass, jint maxBytes, jint deadlineMs)
+{
+    PublishBatcher::instance().Configure(maxBytes > 0 ? static_cast<size_t>(maxBytes) : 0, deadlineMs);
+}
+
+JNIEXPORT void CPP_FUNC_CALL(setPublishMode)(JNIEnv *env, jclass, jstring topic, jboolean coalesce)
+{
+    PublishBatcher::instance().SetMode(JniString(env, topic).str(), coalesce ? BATCH_COALESCE : BATCH_PACK);
+}
+
+JNIEXPORT jstring CPP_FUNC_CALL(publishStats)(JNIEnv *env, jclass)
 {
-    LOGD("JavaFuncCalls::Register c = %s, a = %d.", c, i);
-    return i;
+    PublisherStats pool = PublisherPool::instance().Stats();
+    char text[160];
+    snprintf(text, sizeof(text), "; pool: %llu published, %llu failed, %llu dropped, %llu reconnects",
+             (unsigned long long) pool.published, (unsigned long long) pool.failed,
+             (unsigned long long) pool.dropped, (unsigned long long) pool.reconnects);
+    return env->NewStringUTF((PublishBatcher::instance().StatsText() + text).c_str());
 }
 
 JNIEXPORT void
 CPP_FUNC_CALL(callJavaMethod)(JNIEnv *env, jclass, jstring method, jint action, jstring content,
                               jboolean statics)
 {
-    JavaFuncCalls::GetInstance().CallBack(Jstring2Cstring(env, method),
-                                          static_cast<int>(action),
-                                          Jstring2Cstring(env, content).c_str(),
-                                          statics);
-    JavaFuncCalls::CALLBACK call = callback;
-    int val = JavaFuncCalls::GetInstance().Register(const_cast<char *>("aaa"), call);
-    LOGI("callback = %p, val = %d.", call, val);
+    JniString name(env, method);
+    JniString text(env, content);
+    JavaFuncCalls::GetInstance().CallBack(name.str(), static_cast<int>(action), text.c_str(), statics);
 }
 
 JNIEXPORT void JNICALL
@@ -211,9 +287,7 @@ CPP_FUNC_VIEW(setRenderSize)(JNIEnv *, jclass, jint height, jint width)
 JNIEXPORT void JNICALL
 CPP_FUNC_VIEW(setLocalFile)(JNIEnv *env, jclass, jstring file)
 {
-    const char *filename = env->GetStringUTFChars(file, JNI_FALSE);
-    g_filename = filename;
-    env->ReleaseStringUTFChars(file, filename);
+    g_filename = JniString(env, file).str();
 }
 
 JNIEXPORT void JNICALL
@@ -316,6 +390,87 @@ CPP_FUNC_VIEW(updateCpuSurface)(JNIEnv *env, jclass, jobject texture) {
     }
 }
 
+JNIEXPORT jboolean JNICALL
+CPP_FUNC_VIEW(attachFrameSurface)(JNIEnv *env, jclass, jobject texture, jboolean gpu)
+{
+    return FrameRenderer::instance().Attach(env, texture, gpu == JNI_TRUE) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL
+CPP_FUNC_VIEW(detachFrameSurface)(JNIEnv *env, jclass)
+{
+    FrameRenderer::instance().Detach(env);
+}
+
+JNIEXPORT jobjectArray JNICALL
+CPP_FUNC_VIEW(allocateFrames)(JNIEnv *env, jclass, jint count, jint size)
+{
+    FrameRing &ring = FrameRing::instance();
+    if (size <= 0 || !ring.Allocate(count, static_cast<size_t>(size))) {
+        return nullptr;
+    }
+    jobjectArray buffers = env->NewObjectArray(count, JniRegistry::instance().byteBufferClass, nullptr);
+    if (buffers == nullptr) {
+        return nullptr;
+    }
+    for (jint i = 0; i < count; i++) {
+        jobject buffer = env->NewDirectByteBuffer(ring.Data(i), size);
+        env->SetObjectArrayElement(buffers, i, buffer);
+        env->DeleteLocalRef(buffer);
+    }
+    return buffers;
+}
+
+JNIEXPORT jint JNICALL
+CPP_FUNC_VIEW(acquireFrame)(JNIEnv *, jclass)
+{
+    return FrameRing::instance().Acquire();
+}
+
+JNIEXPORT jboolean JNICALL
+CPP_FUNC_VIEW(submitFrame)(JNIEnv *, jclass, jint index, jint width, jint height, jint format, jlong timestampNs)
+{
+    return FrameRenderer::instance().Submit(index, width, height, format, timestampNs) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL
+CPP_FUNC_VIEW(renderFrame)(JNIEnv *env, jclass, jobject y, jint yStride, jobject u, jobject v, jint uvStride,
+                           jint uvPixelStride, jint width, jint height, jlong timestampNs)
+{
+    // heap buffers have no address, the planes have to be direct (Image.Plane buffers are)
+    FramePlanes frame;
+    frame.y = static_cast<const uint8_t *>(env->GetDirectBufferAddress(y));
+    frame.u = static_cast<const uint8_t *>(env->GetDirectBufferAddress(u));
+    frame.v = static_cast<const uint8_t *>(env->GetDirectBufferAddress(v));
+    if (frame.y == nullptr || frame.u == nullptr || frame.v == nullptr) {
+        LOGE("frame planes are not direct buffers");
+        return JNI_FALSE;
+    }
+    jlong chromaRows = (height + 1) / 2;
+    // the last row of an Image.Plane may stop short of its stride
+    jlong yNeed = static_cast<jlong>(yStride) * (height - 1) + width;
+    jlong uvRow = static_cast<jlong>((width + 1) / 2 - 1) * uvPixelStride + 1;
+    jlong uvNeed = static_cast<jlong>(uvStride) * (chromaRows - 1) + uvRow;
+    if (width <= 0 || height <= 0 || yStride < width || (uvPixelStride != 1 && uvPixelStride != 2)
+        || uvStride < uvRow || env->GetDirectBufferCapacity(y) < yNeed
+        || env->GetDirectBufferCapacity(u) < uvNeed || env->GetDirectBufferCapacity(v) < uvNeed) {
+        LOGE("frame %dx%d does not fit its planes", width, height);
+        return JNI_FALSE;
+    }
+    // interleaved chroma is drawn as one two-channel plane, u and v must be neighbours in it
+    if (uvPixelStride == 2 && frame.u - frame.v != 1 && frame.v - frame.u != 1) {
+        LOGE("chroma planes of pixel stride 2 are not interleaved");
+        return JNI_FALSE;
+    }
+    frame.yStride = yStride;
+    frame.uvStride = uvStride;
+    frame.uvPixelStride = uvPixelStride;
+    frame.width = width;
+    frame.height = height;
+    frame.timestamp = timestampNs;
+    return FrameRenderer::instance().Render(frame) ? JNI_TRUE : JNI_FALSE;
+}
+
 JNIEXPORT jlong JNICALL CPP_FUNC_TIME(getAbsoluteTimestamp)(JNIEnv *, jclass)
 {
     return TimeStamp::AbsoluteTime();
@@ -330,31 +485,58 @@ JNIEXPORT jlong JNICALL CPP_FUNC_TIME(getBootTimestamp)(JNIEnv *, jclass)
 #include <iostream>
 #include <decode/Pcm2Wav.h>
 #include <network/UdpSocket.h>
+#include <network/UdpSender.h>
+#include <network/UdpReassembly.h>
 #include <network/TcpSocket.h>
+#include <network/KcpTransport.h>
+#include <network/KcpScheduler.h>
+#include <network/KcpSweep.h>
+#include <network/KcpAllocator.h>
+#include <network/KcpMux.h>
+#include <network/FecCodec.h>
 // #include <template/Clazz1.h>
 // #include <template/Clazz2.h>
 
-static int g_msgLen = 6;
-
 JNIEXPORT jint JNICALL
 CPP_FUNC_FILE(convertAudioFiles)(JNIEnv *env, jclass, jstring from, jstring save)
 {
-    return convertAudioFiles(Jstring2Cstring(env, from).c_str(),
-                             Jstring2Cstring(env, save).c_str());
+    return convertAudioFiles(JniString(env, from).c_str(), JniString(env, save).c_str());
+}
+
+namespace {
+    std::mutex g_udpLock;
+    // fec of the udp sender and of a udp server started afterwards, both ends need the same
+    unsigned int g_udpFecData = 0;
+    unsigned int g_udpFecParity = 0;
+
+    UdpSender &UdpClient()
+    {
+        static UdpSender sender("127.0.0.1", 8899);
+        return sender;
+    }
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(setUdpFec)(JNIEnv *, jclass, jint data, jint parity)
+{
+    if (data < 0 || parity < 0 || data > (jint) FEC_MAX_DATA || parity > (jint) FEC_MAX_PARITY) {
+        LOGE("invalid udp fec %d + %d.", data, parity);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(g_udpLock);
+    g_udpFecData = static_cast<unsigned int>(data);
+    g_udpFecParity = static_cast<unsigned int>(parity);
+    UdpClient().SetFec(g_udpFecData, g_udpFecParity);
+    LOGI("udp fec %u + %u, restart the udp server to match.", g_udpFecData, g_udpFecParity);
 }
 
 JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(sendUdpData)(JNIEnv *env, jclass,
                                                      jstring text, jint len) {
-    std::string txt = Jstring2Cstring(env, text);
+    JniString txt(env, text);
     const char *tx = txt.c_str();
-    std::string message;
-    message = "text(" + std::to_string(len) + ") = [" + txt + "]";
-    Message::instance().setMessage(message, UDP_CLIENT);
-    LOGI("%s", message.c_str());
-    g_msgLen = len;
-    auto *sock = new UdpSocket("127.0.0.1", 8899);
-    sock->Sender(tx, (unsigned int) len + 1);
-    delete sock;
+    Message::instance().formatMessage(UDP_CLIENT, "text(%d) = [%s]", len, tx);
+    LOGI("text(%d) = [%s]", len, tx);
+    std::lock_guard<std::mutex> lock(g_udpLock);
+    UdpClient().Send(tx, std::min((size_t) len, txt.size()) + 1);
 /*
     auto *clz1 = new Clazz1();
     clz1->setBase<Clazz1>("AAA", 3);
@@ -364,10 +546,11 @@ JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(sendUdpData)(JNIEnv *env, jclass,
     return 0;
 }
 
-void callback(char* data)
+void callback(uint64_t, const char *data, size_t size, void *)
 {
-    if (data[0] != '\0') {
-        Message::instance().setMessage(data, UDP_SERVER);
+    size_t len = strnlen(data, size);
+    if (len > 0) {
+        Message::instance().setMessage(data, len, UDP_SERVER);
     }
 }
 
@@ -375,14 +558,16 @@ JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startUdpServer)(JNIEnv *, jclass)
 {
     std::thread th(
             []() -> void {
-                int total = g_msgLen + (int)sizeof(NetProtocol);
-                char msg[total];
+                UdpReassembly reassembly(callback);
                 auto *sock = new UdpSocket();
+                {
+                    std::lock_guard<std::mutex> lock(g_udpLock);
+                    sock->SetFec(g_udpFecData, g_udpFecParity);
+                }
                 int size;
                 do {
-                    std::string message = "udp receiver starts";
-                    Message::instance().setMessage(message, UDP_SERVER);
-                    size = sock->Receiver(msg, total, callback);
+                    Message::instance().setMessage("udp receiver starts", UDP_SERVER);
+                    size = sock->ReceiveBatch(UdpReassembly::BatchHook, &reassembly);
                     usleep(10000);
                 } while (size != 0);
                 delete sock;
@@ -393,8 +578,9 @@ JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startUdpServer)(JNIEnv *, jclass)
     return 0;
 }
 
-int tcp_callback(uint8_t *data, size_t size)
+int tcp_callback(uint16_t type, const uint8_t *data, size_t size, void *)
 {
+    LOGI("tcp frame type %u, %zu bytes.", type, size);
     Statics::printBuffer((char*)data, size);
     return 0;
 }
@@ -404,8 +590,9 @@ JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startTcpServer)(JNIEnv *, jclass, jint p
     std::thread th(
             [](int port) -> void {
                 TcpSocket tcp;
-                tcp.RegisterCallback(tcp_callback);
-                tcp.Start(port);
+                // peers send TcpFrame messages, one callback per whole message
+                tcp.RegisterFrameCallback(tcp_callback);
+                tcp.StartReactor(port);
             }, port);
     if (th.joinable())
         th.detach();
@@ -428,3 +615,308 @@ JNIEXPORT void JNICALL CPP_FUNC_NETWORK(KcpRun)(JNIEnv *, jclass)
     if (th.joinable())
         th.detach();
 }
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpRingCheck)(JNIEnv *, jclass, jint seed)
+{
+    std::thread th(
+            [](unsigned int seed) -> void {
+                // the sn-indexed rings against the list logic they replace
+                int mismatches = KcpEmulator::RingCheck(seed);
+                char hint[64];
+                sprintf(hint, "Kcp ring check (seed %u): %s.", seed, mismatches == 0 ? "pass" : "FAILED");
+                Message::instance().setMessage(hint, TOAST);
+            }, seed != 0 ? static_cast<unsigned int>(seed) : static_cast<unsigned int>(time(nullptr)));
+    if (th.joinable())
+        th.detach();
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(udpBenchmark)(JNIEnv *, jclass, jint count)
+{
+    std::thread th(
+            [](int count) -> void {
+                int rate = UdpSocket::Benchmark(count > 0 ? count : 100000);
+                char hint[64];
+                sprintf(hint, "Udp batch receiver: %d packets/sec.", rate);
+                Message::instance().setMessage(hint, TOAST);
+            }, count);
+    if (th.joinable())
+        th.detach();
+    return 0;
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(tcpBenchmark)(JNIEnv *, jclass, jint port, jint clients)
+{
+    std::thread th(
+            [](int port, int clients) -> void {
+                int connected = TcpSocket::Benchmark(port, clients > 0 ? clients : 1000);
+                char hint[64];
+                sprintf(hint, "Tcp reactor: %d/%d clients served.", connected, clients);
+                Message::instance().setMessage(hint, TOAST);
+            }, port, clients);
+    if (th.joinable())
+        th.detach();
+    return 0;
+}
+
+namespace {
+    std::mutex g_kcpLock;
+    KcpTransport *g_kcp = nullptr;
+}
+
+void kcp_callback(const char *data, int size, void *)
+{
+    Message::instance().setMessage(data, strnlen(data, size), MESSAGE);
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startKcp)(JNIEnv *env, jclass, jint localPort,
+                                                  jstring peerIp, jint peerPort, jint conv)
+{
+    std::lock_guard<std::mutex> lock(g_kcpLock);
+    if (g_kcp != nullptr) {
+        LOGI("kcp transport already started.");
+        return 0;
+    }
+    auto *kcp = new KcpTransport(static_cast<IUINT32>(conv));
+    int sock = kcp->Open(localPort, JniString(env, peerIp).str(), peerPort);
+    if (sock < 0) {
+        delete kcp;
+        return sock;
+    }
+    kcp->RegisterCallback(kcp_callback);
+    g_kcp = kcp;
+    std::thread th(
+            [](KcpTransport *kcp) -> void {
+                kcp->Run();
+                delete kcp;
+            }, kcp);
+    if (th.joinable())
+        th.detach();
+    return 0;
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(sendKcpData)(JNIEnv *env, jclass, jstring text)
+{
+    JniString txt(env, text);
+    std::lock_guard<std::mutex> lock(g_kcpLock);
+    if (g_kcp == nullptr) {
+        return -1;
+    }
+    return g_kcp->Send(txt.c_str(), static_cast<int>(txt.size()) + 1);
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(stopKcp)(JNIEnv *, jclass)
+{
+    std::lock_guard<std::mutex> lock(g_kcpLock);
+    if (g_kcp != nullptr) {
+        g_kcp->Finish();
+        g_kcp = nullptr;
+    }
+}
+
+namespace {
+    std::mutex g_kcpMuxLock;
+    KcpMux *g_kcpMux = nullptr;
+}
+
+void kcp_mux_callback(IUINT32 conv, const char *data, int size, void *)
+{
+    Message::instance().formatMessage(MESSAGE, "[%x] %.*s", conv, (int) strnlen(data, size), data);
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startKcpMux)(JNIEnv *, jclass, jint port, jint maxSessions)
+{
+    std::lock_guard<std::mutex> lock(g_kcpMuxLock);
+    if (g_kcpMux != nullptr) {
+        LOGI("kcp mux already started.");
+        return 0;
+    }
+    auto *mux = new KcpMux(KcpConfig::Mode(2), maxSessions > 0 ? maxSessions : 1024);
+    int sock = mux->Open(port);
+    if (sock < 0) {
+        delete mux;
+        return sock;
+    }
+    mux->RegisterCallback(kcp_mux_callback);
+    g_kcpMux = mux;
+    std::thread th(
+            [](KcpMux *mux) -> void {
+                mux->Run();
+                delete mux;
+            }, mux);
+    if (th.joinable())
+        th.detach();
+    return 0;
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(stopKcpMux)(JNIEnv *, jclass)
+{
+    std::lock_guard<std::mutex> lock(g_kcpMuxLock);
+    if (g_kcpMux != nullptr) {
+        g_kcpMux->Finish();
+        g_kcpMux = nullptr;
+    }
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(kcpBenchmark)(JNIEnv *, jclass, jint count)
+{
+    std::thread th(
+            [](int count) -> void {
+                int echoed = KcpTransport::Benchmark(count > 0 ? count : 1000);
+                char hint[64];
+                sprintf(hint, "Kcp transport: %d/%d echoed.", echoed, count);
+                Message::instance().setMessage(hint, TOAST);
+            }, count);
+    if (th.joinable())
+        th.detach();
+    return 0;
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpSchedulerBenchmark)(JNIEnv *, jclass)
+{
+    std::thread th(
+            []() -> void {
+                KcpScheduler::Benchmark();
+                Message::instance().setMessage("Kcp scheduler benchmark finish.", TOAST);
+            });
+    if (th.joinable())
+        th.detach();
+}
+
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(kcpSweep)(JNIEnv *env, jclass, jstring dir)
+{
+    std::string path = JniString(env, dir).str();
+    std::thread th(
+            [](const std::string &path) -> void {
+                KcpSweepSpec spec;
+                int runs = KcpSweep(spec, path + "/kcp_sweep.csv", path + "/kcp_sweep.json");
+                char hint[64];
+                sprintf(hint, "Kcp sweep: %d runs.", runs);
+                Message::instance().setMessage(hint, TOAST);
+            }, path);
+    if (th.joinable())
+        th.detach();
+    return 0;
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpAllocatorBenchmark)(JNIEnv *, jclass)
+{
+    std::thread th(
+            []() -> void {
+                KcpAllocator::Benchmark();
+                Message::instance().setMessage("Kcp allocator benchmark finish.", TOAST);
+            });
+    if (th.joinable())
+        th.detach();
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpMuxBenchmark)(JNIEnv *, jclass, jint sessions)
+{
+    std::thread th(
+            [](int sessions) -> void {
+                int echoed = KcpMux::Benchmark(sessions > 0 ? sessions : 256);
+                char hint[64];
+                sprintf(hint, "Kcp mux: %d echoed.", echoed);
+                Message::instance().setMessage(hint, TOAST);
+            }, sessions);
+    if (th.joinable())
+        th.detach();
+}
+
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(fecBenchmark)(JNIEnv *, jclass, jint data, jint parity, jdouble loss)
+{
+    std::thread th(
+            [](int data, int parity, double loss) -> void {
+                FecDecoder::Benchmark(data > 0 ? data : 10, parity >= 0 ? parity : 3, loss);
+                Message::instance().setMessage("Fec benchmark finish.", TOAST);
+            }, data, parity, loss);
+    if (th.joinable())
+        th.detach();
+}
+
+namespace {
+    // bound by JniRegistry::Load in JNI_OnLoad, signatures must match the wrapper classes exactly
+    const JNINativeMethod g_callbackNatives[] = {
+            {"initJvmEnv",       "(Ljava/lang/String;)V",                   (void *) Callback_WRAPPER(initJvmEnv)},
+            {"stringGetJNI",     "()Ljava/lang/String;",                    (void *) Callback_WRAPPER(stringGetJNI)},
+            {"getMessage",       "(Lcom/tsymiar/devidroid/data/Receiver;)Lcom/tsymiar/devidroid/data/Receiver;",
+                                                                            (void *) Callback_WRAPPER(getMessage)},
+            {"drainMessages",    "(Ljava/nio/ByteBuffer;I)I",               (void *) Callback_WRAPPER(drainMessages)},
+            {"waitMessages",     "(I)Z",                                    (void *) Callback_WRAPPER(waitMessages)},
+            {"messageBenchmark", "(I)V",                                    (void *) Callback_WRAPPER(messageBenchmark)},
+            {"jniBenchmark",     "(I)V",                                    (void *) Callback_WRAPPER(jniBenchmark)},
+            {"timeSetJNI",       "([BI)J",                                  (void *) Callback_WRAPPER(timeSetJNI)},
+            {"callJavaMethod",   "(Ljava/lang/String;ILjava/lang/String;Z)V", (void *) Callback_WRAPPER(callJavaMethod)},
+            {"StartSubscribe",   "(Ljava/lang/String;ILjava/lang/String;Ljava/lang/String;I)I",
+                                                                            (void *) Callback_WRAPPER(StartSubscribe)},
+            {"Publish",          "(Ljava/lang/String;Ljava/lang/String;)V", (void *) Callback_WRAPPER(Publish)},
+            {"publishBenchmark", "(I)V",                                    (void *) Callback_WRAPPER(publishBenchmark)},
+            {"setPublishBatching", "(II)V",                                 (void *) Callback_WRAPPER(setPublishBatching)},
+            {"setPublishMode",   "(Ljava/lang/String;Z)V",                  (void *) Callback_WRAPPER(setPublishMode)},
+            {"publishStats",     "()Ljava/lang/String;",                    (void *) Callback_WRAPPER(publishStats)},
+            {"QuitSubscribe",    "()V",                                     (void *) Callback_WRAPPER(QuitSubscribe)},
+    };
+
+    const JNINativeMethod g_viewNatives[] = {
+            {"unloadSurfaceView", "()V",                                   (void *) View_WRAPPER(unloadSurfaceView)},
+            {"setRenderSize",     "(II)V",                                 (void *) View_WRAPPER(setRenderSize)},
+            {"setLocalFile",      "(Ljava/lang/String;)V",                 (void *) View_WRAPPER(setLocalFile)},
+            {"updateEglTexture",  "(Landroid/graphics/SurfaceTexture;)V",  (void *) View_WRAPPER(updateEglTexture)},
+            {"updateEglSurface",  "(Landroid/graphics/SurfaceTexture;)V",  (void *) View_WRAPPER(updateEglSurface)},
+            {"updateCpuTexture",  "(Landroid/graphics/SurfaceTexture;I)V", (void *) View_WRAPPER(updateCpuTexture)},
+            {"updateCpuSurface",  "(Landroid/graphics/SurfaceTexture;)V",  (void *) View_WRAPPER(updateCpuSurface)},
+            {"attachFrameSurface", "(Landroid/graphics/SurfaceTexture;Z)Z", (void *) View_WRAPPER(attachFrameSurface)},
+            {"detachFrameSurface", "()V",                                   (void *) View_WRAPPER(detachFrameSurface)},
+            {"allocateFrames",     "(II)[Ljava/nio/ByteBuffer;",            (void *) View_WRAPPER(allocateFrames)},
+            {"acquireFrame",       "()I",                                   (void *) View_WRAPPER(acquireFrame)},
+            {"submitFrame",        "(IIIIJ)Z",                              (void *) View_WRAPPER(submitFrame)},
+            {"renderFrame",        "(Ljava/nio/ByteBuffer;ILjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIIIJ)Z",
+                                                                            (void *) View_WRAPPER(renderFrame)},
+    };
+
+    const JNINativeMethod g_timeNatives[] = {
+            {"getAbsoluteTimestamp", "()J", (void *) Time_WRAPPER(getAbsoluteTimestamp)},
+            {"getBootTimestamp",     "()J", (void *) Time_WRAPPER(getBootTimestamp)},
+    };
+
+    const JNINativeMethod g_fileNatives[] = {
+            {"convertAudioFiles", "(Ljava/lang/String;Ljava/lang/String;)I", (void *) File_WRAPPER(convertAudioFiles)},
+    };
+
+    const JNINativeMethod g_networkNatives[] = {
+            {"sendUdpData",           "(Ljava/lang/String;I)I",    (void *) Network_WRAPPER(sendUdpData)},
+            {"startUdpServer",        "()I",                       (void *) Network_WRAPPER(startUdpServer)},
+            {"setUdpFec",             "(II)V",                     (void *) Network_WRAPPER(setUdpFec)},
+            {"startTcpServer",        "(I)I",                      (void *) Network_WRAPPER(startTcpServer)},
+            {"KcpRun",                "()V",                       (void *) Network_WRAPPER(KcpRun)},
+            {"udpBenchmark",          "(I)I",                      (void *) Network_WRAPPER(udpBenchmark)},
+            {"tcpBenchmark",          "(II)I",                     (void *) Network_WRAPPER(tcpBenchmark)},
+            {"startKcp",              "(ILjava/lang/String;II)I",  (void *) Network_WRAPPER(startKcp)},
+            {"sendKcpData",           "(Ljava/lang/String;)I",     (void *) Network_WRAPPER(sendKcpData)},
+            {"stopKcp",               "()V",                       (void *) Network_WRAPPER(stopKcp)},
+            {"startKcpMux",           "(II)I",                     (void *) Network_WRAPPER(startKcpMux)},
+            {"stopKcpMux",            "()V",                       (void *) Network_WRAPPER(stopKcpMux)},
+            {"kcpBenchmark",          "(I)I",                      (void *) Network_WRAPPER(kcpBenchmark)},
+            {"kcpSchedulerBenchmark", "()V",                       (void *) Network_WRAPPER(kcpSchedulerBenchmark)},
+            {"kcpSweep",              "(Ljava/lang/String;)I",     (void *) Network_WRAPPER(kcpSweep)},
+            {"kcpAllocatorBenchmark", "()V",                       (void *) Network_WRAPPER(kcpAllocatorBenchmark)},
+            {"kcpMuxBenchmark",       "(I)V",                      (void *) Network_WRAPPER(kcpMuxBenchmark)},
+            {"fecBenchmark",          "(IID)V",                    (void *) Network_WRAPPER(fecBenchmark)},
+            {"kcpRingCheck",          "(I)V",                      (void *) Network_WRAPPER(kcpRingCheck)},
+    };
+
+#define NATIVES(clazz, table) \
+    JniRegistry::AddNatives("com/tsymiar/devidroid/wrapper/" clazz, table, sizeof(table) / sizeof(*(table)))
+
+    // also at load time: ikcp blocks must all come from one allocator, so the pool is installed
+    // before any entry point can create a kcp object
+    __attribute__((unused)) const bool g_kcpAllocator = (KcpAllocator::Install(), true);
+
+    // runs while the library is being loaded, before JNI_OnLoad
+    __attribute__((unused)) const bool g_nativesAdded = NATIVES("CallbackWrapper", g_callbackNatives)
+            && NATIVES("ViewWrapper", g_viewNatives)
+            && NATIVES("TimeWrapper", g_timeNatives)
+            && NATIVES("FileWrapper", g_fileNatives)
+            && NATIVES("NetWrapper", g_networkNatives);
+
+#undef NATIVES
+}
@@ -25,9 +25,17 @@ extern "C" {
 JNIEXPORT void CPP_FUNC_CALL(initJvmEnv)(JNIEnv *env, jclass clazz, jstring class_name);
 JNIEXPORT jstring CPP_FUNC_CALL(stringGetJNI)(JNIEnv *env, jobject clazz);
 JNIEXPORT jobject CPP_FUNC_CALL(getMessage)(JNIEnv *env, jobject , jobject clazz);
+JNIEXPORT jint CPP_FUNC_CALL(drainMessages)(JNIEnv *env, jobject , jobject buffer, jint max);
+JNIEXPORT jboolean CPP_FUNC_CALL(waitMessages)(JNIEnv *, jobject , jint timeoutMs);
+JNIEXPORT void CPP_FUNC_CALL(messageBenchmark)(JNIEnv *, jclass , jint rounds);
+JNIEXPORT void CPP_FUNC_CALL(jniBenchmark)(JNIEnv *, jclass , jint rounds);
 JNIEXPORT jlong CPP_FUNC_CALL(timeSetJNI)(JNIEnv *env, jobject clazz, jbyteArray time, jint len);
 JNIEXPORT jint CPP_FUNC_CALL(StartSubscribe)(JNIEnv *env, jclass clazz, jstring addr, jint port, jstring topic, jstring viewId, jint id);
 JNIEXPORT void CPP_FUNC_CALL(Publish)(JNIEnv *env, jclass clazz, jstring topic, jstring payload);
+JNIEXPORT void CPP_FUNC_CALL(publishBenchmark)(JNIEnv *, jclass, jint count);
+JNIEXPORT void CPP_FUNC_CALL(setPublishBatching)(JNIEnv *, jclass, jint maxBytes, jint deadlineMs);
+JNIEXPORT void CPP_FUNC_CALL(setPublishMode)(JNIEnv *env, jclass, jstring topic, jboolean coalesce);
+JNIEXPORT jstring CPP_FUNC_CALL(publishStats)(JNIEnv *env, jclass);
 JNIEXPORT void CPP_FUNC_CALL(QuitSubscribe)(JNIEnv *, jclass clazz);
 
 JNIEXPORT void
@@ -51,6 +59,19 @@ JNIEXPORT void JNICALL
 CPP_FUNC_VIEW(updateCpuTexture)(JNIEnv *env, jclass, jobject , jint);
 JNIEXPORT void JNICALL
 CPP_FUNC_VIEW(updateCpuSurface)(JNIEnv *env, jclass, jobject texture);
+JNIEXPORT jboolean JNICALL
+CPP_FUNC_VIEW(attachFrameSurface)(JNIEnv *env, jclass, jobject texture, jboolean gpu);
+JNIEXPORT void JNICALL
+CPP_FUNC_VIEW(detachFrameSurface)(JNIEnv *env, jclass);
+JNIEXPORT jobjectArray JNICALL
+CPP_FUNC_VIEW(allocateFrames)(JNIEnv *env, jclass, jint count, jint size);
+JNIEXPORT jint JNICALL
+CPP_FUNC_VIEW(acquireFrame)(JNIEnv *, jclass);
+JNIEXPORT jboolean JNICALL
+CPP_FUNC_VIEW(submitFrame)(JNIEnv *, jclass, jint index, jint width, jint height, jint format, jlong timestampNs);
+JNIEXPORT jboolean JNICALL
+CPP_FUNC_VIEW(renderFrame)(JNIEnv *env, jclass, jobject y, jint yStride, jobject u, jobject v, jint uvStride,
+                           jint uvPixelStride, jint width, jint height, jlong timestampNs);
 
 JNIEXPORT jlong JNICALL CPP_FUNC_TIME(getAbsoluteTimestamp)(JNIEnv *, jclass);
 JNIEXPORT jlong JNICALL CPP_FUNC_TIME(getBootTimestamp)(JNIEnv *, jclass);
@@ -61,6 +82,19 @@ JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(sendUdpData)(JNIEnv *, jclass, jstring t
 JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startUdpServer)(JNIEnv *env, jclass);
 JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startTcpServer)(JNIEnv* , jclass, jint);
 JNIEXPORT void JNICALL CPP_FUNC_NETWORK(KcpRun)(JNIEnv* , jclass);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(udpBenchmark)(JNIEnv* , jclass, jint count);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(tcpBenchmark)(JNIEnv* , jclass, jint port, jint clients);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startKcp)(JNIEnv* , jclass, jint localPort, jstring peerIp, jint peerPort, jint conv);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(sendKcpData)(JNIEnv* , jclass, jstring text);
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(stopKcp)(JNIEnv* , jclass);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(startKcpMux)(JNIEnv* , jclass, jint port, jint maxSessions);
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(stopKcpMux)(JNIEnv* , jclass);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(kcpBenchmark)(JNIEnv* , jclass, jint count);
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpSchedulerBenchmark)(JNIEnv* , jclass);
+JNIEXPORT jint JNICALL CPP_FUNC_NETWORK(kcpSweep)(JNIEnv* , jclass, jstring dir);
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpAllocatorBenchmark)(JNIEnv* , jclass);
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(kcpMuxBenchmark)(JNIEnv* , jclass, jint sessions);
+JNIEXPORT void JNICALL CPP_FUNC_NETWORK(fecBenchmark)(JNIEnv* , jclass, jint data, jint parity, jdouble loss);
 #ifdef __cplusplus
 }
 #endif
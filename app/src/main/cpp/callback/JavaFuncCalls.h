@@ -1,23 +1,57 @@
 #ifndef DEVIDROID_JavaFuncCalls_H
 #define DEVIDROID_JavaFuncCalls_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <thread>
 
 class JavaFuncCalls {
 private:
 
-    JavaFuncCalls()= default;
+    JavaFuncCalls();
 
-    ~JavaFuncCalls() = default;
+    ~JavaFuncCalls();
 
-public:
-    typedef int(*CALLBACK)(const char*, int);
+    typedef void(*INVOKE)(const std::string &, int, const char *, bool);
 
-    static JavaFuncCalls& GetInstance();
+    // one queued call of a "(ILjava/lang/String;)V" method on the class initJvmEnv named
+    struct Request {
+        Request *next;
+        std::string method;
+        int action;
+        std::string content;
+        bool statics;
+    };
+
+    void Dispatch();
 
-    int Register(char* method, CALLBACK call);
+    INVOKE m_invoke;
+    std::atomic<Request *> m_pending{nullptr};
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_running{false};
+    std::atomic<uint64_t> m_dispatched{0};
+    std::atomic<uint64_t> m_batches{0};
+    std::once_flag m_start;
+    std::mutex m_lock;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
 
+public:
+    static JavaFuncCalls& GetInstance();
+
+    // thread safe and returns at once, calls run in order on one jvm-attached dispatcher thread
     void CallBack(const std::string &method, int action, const char *content, bool statics);
+
+    // runs what is queued, then stops the dispatcher
+    void Shutdown();
+
+    uint64_t Dispatched() const;
+
+    // 'producers' native threads queue 'count' callbacks each, ns per callback and calls per batch
+    static void Benchmark(int producers = 4, int count = 10000);
 };
 
 #endif //DEVIDROID_JavaFuncCalls_H
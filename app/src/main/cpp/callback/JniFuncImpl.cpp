@@ -3,10 +3,13 @@
 #endif
 
 #include <jni.h>
+#include <pthread.h>
 #include <mutex>
 #include <algorithm>
 #include <thread>
 #include <Utils/logging.h>
+#include "JniRegistry.h"
+#include "JniString.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,6 +21,38 @@ std::string g_className = {};
 }
 #endif
 
+namespace {
+    jint g_jniVersion = -1;
+    pthread_key_t g_envKey;
+    pthread_once_t g_envOnce = PTHREAD_ONCE_INIT;
+
+    // runs when a native thread attached by JVM_Env exits
+    void DetachThread(void *)
+    {
+        if (g_jniJVM != nullptr) {
+            g_jniJVM->DetachCurrentThread();
+        }
+    }
+
+    void CreateEnvKey()
+    {
+        pthread_key_create(&g_envKey, DetachThread);
+    }
+
+    // a pending java exception makes every further jni call on this thread undefined,
+    // and on an attached native thread nothing up the stack would ever clear it
+    bool ClearException(JNIEnv *env, const char *what)
+    {
+        if (!env->ExceptionCheck()) {
+            return false;
+        }
+        LOGE("java exception in %s.", what);
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        return true;
+    }
+}
+
 JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void * /*reserved*/)
 {
     typedef union {
@@ -27,7 +62,7 @@ JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void * /*reserved*/)
     UnionJNIEnvToVoid envToVoid;
     LOGI("Media Tag: JNI OnLoad\n");
 
-    static jint JNI_VERSION = -1;
+    jint JNI_VERSION = -1;
 #ifdef JNI_VERSION_1_6
     if (JNI_VERSION == -1 && vm->GetEnv(&envToVoid.rsv, JNI_VERSION_1_6) == JNI_OK) {
         LOGI("JNI_OnLoad: JNI_VERSION_1_6");
@@ -46,64 +81,68 @@ JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void * /*reserved*/)
         JNI_VERSION = JNI_VERSION_1_2;
     }
 #endif
+    if (JNI_VERSION != -1) {
+        g_jniVersion = JNI_VERSION;
+        g_jniJVM = vm;
+        JniRegistry::instance().Load(envToVoid.env);
+    }
     return JNI_VERSION;
 }
 
-int JVM_Attach()
+JNIEXPORT void JNI_OnUnload(JavaVM *vm, void * /*reserved*/)
+{
+    JNIEnv *env = nullptr;
+    if (vm->GetEnv((void **) &env, g_jniVersion) == JNI_OK) {
+        JniRegistry::instance().Unload(env);
+    }
+}
+
+// env of the calling thread: a native thread is attached on its first call and stays attached
+// until it exits, java threads are never touched
+JNIEnv *JVM_Env()
 {
-    JNIEnv *myNewEnv;
     if (nullptr == g_jniJVM) {
         LOGE("g_jniJVM == NULL");
-        return -1;
+        return nullptr;
     }
-    int attack = 0;
-    jint version = JNI_OnLoad(g_jniJVM, nullptr);
+    jint version = g_jniVersion;
     if (version == -1) {
         LOGE("version cant load!");
-        return -1;
+        return nullptr;
     }
-    JavaVMAttachArgs jvmArgs = {version, __FUNCTION__, nullptr};
-    int env = g_jniJVM->GetEnv((void **) &myNewEnv, version);
-    if (JNI_EDETACHED == env) {
-        LOGD("callback_handler:failed to get JNI environment assuming native thread");
-        env = g_jniJVM->AttachCurrentThread(&myNewEnv, &jvmArgs);
-        if (env < 0) {
-            LOGE("callback_handler: failed to attach current thread");
-            return -2;
-        }
-        attack = 1;
+    JNIEnv *env = nullptr;
+    int state = g_jniJVM->GetEnv((void **) &env, version);
+    if (state == JNI_OK) {
+        return env;
     }
-    return attack;
+    if (state != JNI_EDETACHED) {
+        LOGE("callback_handler: GetEnv fail with %d", state);
+        return nullptr;
+    }
+    JavaVMAttachArgs jvmArgs = {version, "NativeThread", nullptr};
+    if (g_jniJVM->AttachCurrentThread(&env, &jvmArgs) != JNI_OK) {
+        LOGE("callback_handler: failed to attach current thread");
+        return nullptr;
+    }
+    pthread_once(&g_envOnce, CreateEnvKey);
+    pthread_setspecific(g_envKey, env);
+    return env;
 }
 
 jstring Cstring2Jstring(JNIEnv *env, const char *pat)
 {
-    jclass clz = env->FindClass("java/lang/String");
-    jmethodID jmId = env->GetMethodID(clz, "<init>", "([BLjava/lang/String;)V");
-    jbyteArray bytes = env->NewByteArray(strlen(pat));
-    env->SetByteArrayRegion(bytes, 0, strlen(pat), (jbyte *) pat);
-    jstring encoding = env->NewStringUTF("utf-8");
-    return (jstring) env->NewObject(clz, jmId, bytes, encoding);
+    JniRegistry &registry = JniRegistry::instance();
+    jsize len = static_cast<jsize>(strlen(pat));
+    jbyteArray bytes = env->NewByteArray(len);
+    env->SetByteArrayRegion(bytes, 0, len, (jbyte *) pat);
+    auto string = (jstring) env->NewObject(registry.stringClass, registry.stringInit, bytes, registry.utf8);
+    env->DeleteLocalRef(bytes);
+    return string;
 }
 
 std::string Jstring2Cstring(JNIEnv *env, jstring jstr)
 {
-    char *rtn = nullptr;
-    jclass clz = env->FindClass("java/lang/String");
-    jstring encode = env->NewStringUTF("utf-8");
-    jmethodID mid = env->GetMethodID(clz, "getBytes", "(Ljava/lang/String;)[B");
-    auto barr = (jbyteArray) env->CallObjectMethod(jstr, mid, encode);
-    auto len = static_cast<size_t>(env->GetArrayLength(barr));
-    jbyte *ba = env->GetByteArrayElements(barr, JNI_FALSE);
-    if (len > 0) {
-        rtn = (char *) malloc(len + 1);
-        memcpy(rtn, ba, len);
-        rtn[len] = 0;
-    }
-    env->ReleaseByteArrayElements(barr, ba, 0);
-    std::string temp(rtn);
-    free(rtn);
-    return temp;
+    return JniString(env, jstr).str();
 }
 
 jstring GetPackageName(JNIEnv *env)
@@ -138,49 +177,50 @@ jstring GetPackageName(JNIEnv *env)
 
 void CallBackJavaMethod(const std::string &method, int action, const char *content, bool statics)
 {
-    int attack = JVM_Attach();
-    if (attack < 0) {
-        LOGE("failed to attach to java vm.");
-        return;
-    }
     const char *clzz = g_className.c_str();
-    std::string cname = g_className;
-    replace(cname.begin(), cname.end(), '.', '/');
-    JNIEnv *env;
-    if (0 != g_jniJVM->GetEnv((void **) &env, JNI_VERSION_1_6)) {
-        LOGE("GetEnv fail with JNI_VERSION_1_6, '%s'.", clzz);
+    JNIEnv *env = JVM_Env();
+    if (env == nullptr) {
+        LOGE("failed to attach to java vm, '%s'.", clzz);
         return;
     }
-    if (env == nullptr) {
-        LOGE("env of class '%s' is NULL.", clzz);
+    LOGI("calling java class %s, method: %s, action = %d, content = %s.",
+         clzz, method.c_str(), action, content);
+    // class and method ids were resolved by initJvmEnv on a java thread and stay cached
+    JniRegistry &registry = JniRegistry::instance();
+    jclass cls = registry.CallbackClass();
+    jmethodID jmID = registry.CallbackMethod(env, method, statics);
+    if (cls == nullptr || jmID == nullptr) {
+        LOGE("class '%s' or its method '%s' is not registered.", clzz, method.c_str());
         return;
     }
-    LOGI("calling java class %s(%s), method: %s, action = %d, content = %s.",
-         clzz, cname.c_str(), method.c_str(), action, content);
-    jclass cls = env->FindClass(cname.c_str());
-    g_jniCls = (jclass) env->NewGlobalRef(cls);
     jstring msg = env->NewStringUTF(content);
-    constexpr const char *mthTag = "(ILjava/lang/String;)V";
+    if (ClearException(env, "NewStringUTF")) {
+        return;
+    }
     if (statics) {
-        jmethodID jmID = env->GetStaticMethodID(g_jniCls, method.c_str(), mthTag);
-        env->CallStaticVoidMethod(g_jniCls, jmID, action, msg);
+        env->CallStaticVoidMethod(cls, jmID, action, msg);
+        ClearException(env, method.c_str());
     } else {
-        jmethodID jmID = env->GetMethodID(g_jniCls, method.c_str(), mthTag);
-        jobject obj = env->AllocObject(g_jniCls);
+        jobject obj = env->AllocObject(cls);
+        if (ClearException(env, "AllocObject") || obj == nullptr) {
+            LOGE("failed to instantiate '%s'.", clzz);
+            env->DeleteLocalRef(msg);
+            return;
+        }
         env->CallVoidMethod(obj, jmID, action, msg);
+        ClearException(env, method.c_str());
         env->DeleteLocalRef(obj);
     }
     env->DeleteLocalRef(msg);
-    if (attack == 1) g_jniJVM->DetachCurrentThread();
 }
 
 void SetContentView(JNIEnv *env, jclass cls)
 {
-    if (g_jniJVM == nullptr) {
+    env = JVM_Env();
+    if (env == nullptr) {
         LOGE("failed to attach to java vm.");
         return;
     }
-    g_jniJVM->AttachCurrentThread(&env, nullptr);
     jclass layout_res = env->FindClass("com/tsymiar/devidroid/R$layout");
     jfieldID fieldID_main = env->GetStaticFieldID(layout_res, "main", "I");
     jint main = env->GetStaticIntField(layout_res, fieldID_main);
@@ -197,16 +237,15 @@ void SetContentView(JNIEnv *env, jclass cls)
         return;
     }
     env->CallVoidMethod(cls, methodID_func, main);
-    g_jniJVM->DetachCurrentThread();
 }
 
 void SetTextView(JNIEnv *env, jclass cls, const std::string& viewId, const std::string& text)
 {
-    if (g_jniJVM == nullptr) {
+    env = JVM_Env();
+    if (env == nullptr) {
         LOGE("failed to attach to java vm.");
         return;
     }
-    g_jniJVM->AttachCurrentThread(&env, nullptr);
     jclass activity_clazz = env->FindClass("android/app/Activity");
     if (activity_clazz == nullptr) {
         LOGE("FindClass activity_clazz error");
@@ -237,17 +276,16 @@ void SetTextView(JNIEnv *env, jclass cls, const std::string& viewId, const std::
     jstring text_ref = env->NewStringUTF(text.c_str());
     env->CallVoidMethod(method_findView, methodID_TextView, text_ref);
     env->DeleteLocalRef(text_ref);
-    g_jniJVM->DetachCurrentThread();
     LOGI("View.setText: %s = [%s]", viewId.c_str(), text.c_str());
 }
 
 void SetActivityViewText(JNIEnv *env, int viewId, const char* text)
 {
-    if (g_jniJVM == nullptr) {
+    env = JVM_Env();
+    if (env == nullptr) {
         LOGE("failed to attach to java vm.");
         return;
     }
-    g_jniJVM->AttachCurrentThread(&env, nullptr);
     jstring msg = env->NewStringUTF(text);
     if (viewId <= 0) {
         LOGE("invalid viewId = %d", viewId);
@@ -269,6 +307,5 @@ void SetActivityViewText(JNIEnv *env, int viewId, const char* text)
         env->CallStaticVoidMethod(g_jniCls, setText, msg);
     }
     env->DeleteLocalRef(msg);
-    g_jniJVM->DetachCurrentThread();
     LOGI("View.setText: %d, %s", viewId, text);
 }
@@ -0,0 +1,180 @@
+#ifndef LOG_TAG
+#define LOG_TAG "JniRegistry"
+#endif
+
+#include "JniRegistry.h"
+#include <chrono>
+#include <Utils/logging.h>
+
+JniRegistry& JniRegistry::instance()
+{
+    static JniRegistry registry;
+    return registry;
+}
+
+std::vector<JniRegistry::Natives>& JniRegistry::NativeTables()
+{
+    static std::vector<Natives> tables;
+    return tables;
+}
+
+bool JniRegistry::AddNatives(const char *className, const JNINativeMethod *methods, int count)
+{
+    NativeTables().push_back({className, methods, count});
+    return true;
+}
+
+jclass JniRegistry::GlobalClass(JNIEnv *env, const char *name)
+{
+    jclass local = env->FindClass(name);
+    if (local == nullptr) {
+        env->ExceptionClear();
+        LOGE("class '%s' can not be found", name);
+        return nullptr;
+    }
+    auto global = reinterpret_cast<jclass>(env->NewGlobalRef(local));
+    env->DeleteLocalRef(local);
+    return global;
+}
+
+bool JniRegistry::Load(JNIEnv *env)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_loaded) {
+        return true;
+    }
+    bool ok = true;
+    stringClass = GlobalClass(env, "java/lang/String");
+    if (stringClass != nullptr) {
+        stringInit = env->GetMethodID(stringClass, "<init>", "([BLjava/lang/String;)V");
+        stringGetBytes = env->GetMethodID(stringClass, "getBytes", "(Ljava/lang/String;)[B");
+        jstring local = env->NewStringUTF("utf-8");
+        utf8 = reinterpret_cast<jstring>(env->NewGlobalRef(local));
+        env->DeleteLocalRef(local);
+    }
+    ok = ok && stringInit != nullptr && stringGetBytes != nullptr;
+    surfaceClass = GlobalClass(env, "android/view/Surface");
+    if (surfaceClass != nullptr) {
+        surfaceInit = env->GetMethodID(surfaceClass, "<init>", "(Landroid/graphics/SurfaceTexture;)V");
+        surfaceRelease = env->GetMethodID(surfaceClass, "release", "()V");
+    }
+    ok = ok && surfaceInit != nullptr && surfaceRelease != nullptr;
+    byteBufferClass = GlobalClass(env, "java/nio/ByteBuffer");
+    ok = ok && byteBufferClass != nullptr;
+    receiverClass = GlobalClass(env, "com/tsymiar/devidroid/data/Receiver");
+    if (receiverClass != nullptr) {
+        receiverMessage = env->GetFieldID(receiverClass, "message", "Ljava/lang/String;");
+        receiverWhat = env->GetFieldID(receiverClass, "receiver", "I");
+    }
+    ok = ok && receiverMessage != nullptr && receiverWhat != nullptr;
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+    }
+    // a table that fails to bind still resolves through the exported Java_* symbols
+    for (const auto &natives : NativeTables()) {
+        jclass clazz = env->FindClass(natives.className);
+        if (clazz == nullptr || env->RegisterNatives(clazz, natives.methods, natives.count) != JNI_OK) {
+            env->ExceptionClear();
+            LOGE("RegisterNatives of '%s' fail", natives.className);
+            ok = false;
+        }
+        if (clazz != nullptr) {
+            env->DeleteLocalRef(clazz);
+        }
+    }
+    m_loaded = true;
+    LOGI("jni registry loaded %zu native tables, %s.", NativeTables().size(), ok ? "ok" : "with errors");
+    return ok;
+}
+
+void JniRegistry::Unload(JNIEnv *env)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    jobject refs[] = {stringClass, utf8, surfaceClass, byteBufferClass, receiverClass, m_callbackClass};
+    for (auto ref : refs) {
+        if (ref != nullptr) {
+            env->DeleteGlobalRef(ref);
+        }
+    }
+    stringClass = nullptr;
+    utf8 = nullptr;
+    surfaceClass = nullptr;
+    byteBufferClass = nullptr;
+    receiverClass = nullptr;
+    m_callbackClass = nullptr;
+    m_callbackMethods.clear();
+    m_loaded = false;
+}
+
+jclass JniRegistry::SetCallbackClass(JNIEnv *env, const std::string &name)
+{
+    jclass clazz = GlobalClass(env, name.c_str());
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_callbackClass != nullptr) {
+        env->DeleteGlobalRef(m_callbackClass);
+    }
+    m_callbackClass = clazz;
+    m_callbackMethods.clear();
+    return clazz;
+}
+
+jclass JniRegistry::CallbackClass()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_callbackClass;
+}
+
+jmethodID JniRegistry::CallbackMethod(JNIEnv *env, const std::string &method, bool statics)
+{
+    constexpr const char *signature = "(ILjava/lang/String;)V";
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_callbackClass == nullptr) {
+        return nullptr;
+    }
+    std::string key = (statics ? "static " : "") + method;
+    auto it = m_callbackMethods.find(key);
+    if (it != m_callbackMethods.end()) {
+        return it->second;
+    }
+    jmethodID id = statics ? env->GetStaticMethodID(m_callbackClass, method.c_str(), signature)
+                           : env->GetMethodID(m_callbackClass, method.c_str(), signature);
+    if (id == nullptr) {
+        env->ExceptionClear();
+        LOGE("method '%s' can not be found", method.c_str());
+        return nullptr;
+    }
+    m_callbackMethods.emplace(key, id);
+    return id;
+}
+
+void JniRegistry::Benchmark(JNIEnv *env, int rounds)
+{
+    JniRegistry &registry = instance();
+    if (!registry.m_loaded || rounds <= 0) {
+        LOGE("jni registry not loaded");
+        return;
+    }
+    // the same call both ways: String.getBytes("utf-8") as Jstring2Cstring makes it, once with
+    // the lookups it used to do every time, once with the ids the registry keeps
+    jstring text = env->NewStringUTF("0123456789abcdef");
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        jclass string = env->FindClass("java/lang/String");
+        jstring encode = env->NewStringUTF("utf-8");
+        jmethodID getBytes = env->GetMethodID(string, "getBytes", "(Ljava/lang/String;)[B");
+        jobject bytes = env->CallObjectMethod(text, getBytes, encode);
+        env->DeleteLocalRef(bytes);
+        env->DeleteLocalRef(encode);
+        env->DeleteLocalRef(string);
+    }
+    double lookup = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        jobject bytes = env->CallObjectMethod(text, registry.stringGetBytes, registry.utf8);
+        env->DeleteLocalRef(bytes);
+    }
+    double cached = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    env->DeleteLocalRef(text);
+    LOGI("jni getBytes: %d rounds, %.0f ns per call with lookups, %.0f ns per call with cached ids.",
+         rounds, lookup / rounds, cached / rounds);
+}
@@ -0,0 +1,73 @@
+#ifndef DEVIDROID_JNIREGISTRY_H
+#define DEVIDROID_JNIREGISTRY_H
+
+#include <jni.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// classes, method and field ids of every java type the native side touches,
+// resolved once in JNI_OnLoad and shared by all threads
+class JniRegistry {
+public:
+    static JniRegistry& instance();
+
+    // global refs and ids of the fixed types, then RegisterNatives for every added table
+    bool Load(JNIEnv *env);
+
+    void Unload(JNIEnv *env);
+
+    // natives of one wrapper class, bound by Load; add them before the library finishes loading
+    static bool AddNatives(const char *className, const JNINativeMethod *methods, int count);
+
+    // the class initJvmEnv names, found on the java thread: FindClass on a native thread
+    // only sees system classes; the previous one is released
+    jclass SetCallbackClass(JNIEnv *env, const std::string &name);
+
+    jclass CallbackClass();
+
+    // ids of the callback class' "(ILjava/lang/String;)V" methods, looked up once per name
+    jmethodID CallbackMethod(JNIEnv *env, const std::string &method, bool statics);
+
+    // String.getBytes with the per-call lookups it used to need against the cached ids, ns per call on 'env'
+    static void Benchmark(JNIEnv *env, int rounds = 10000);
+
+    // java.lang.String
+    jclass stringClass = nullptr;
+    jmethodID stringInit = nullptr;
+    jmethodID stringGetBytes = nullptr;
+    jstring utf8 = nullptr;
+    // android.view.Surface
+    jclass surfaceClass = nullptr;
+    jmethodID surfaceInit = nullptr;
+    jmethodID surfaceRelease = nullptr;
+    // java.nio.ByteBuffer, element type of the frame buffers handed to java
+    jclass byteBufferClass = nullptr;
+    // com.tsymiar.devidroid.data.Receiver
+    jclass receiverClass = nullptr;
+    jfieldID receiverMessage = nullptr;
+    jfieldID receiverWhat = nullptr;
+
+private:
+    JniRegistry() = default;
+
+    ~JniRegistry() = default;
+
+    struct Natives {
+        const char *className;
+        const JNINativeMethod *methods;
+        int count;
+    };
+
+    static std::vector<Natives>& NativeTables();
+
+    jclass GlobalClass(JNIEnv *env, const char *name);
+
+    std::mutex m_lock;
+    bool m_loaded = false;
+    jclass m_callbackClass = nullptr;
+    std::unordered_map<std::string, jmethodID> m_callbackMethods;
+};
+
+#endif //DEVIDROID_JNIREGISTRY_H
@@ -0,0 +1,135 @@
+#ifndef LOG_TAG
+#define LOG_TAG "JniString"
+#endif
+
+#include "JniString.h"
+#include "JniRegistry.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <Utils/logging.h>
+
+constexpr size_t JniString::INLINE_SIZE;
+
+namespace {
+    // jni hands out modified utf-8: NUL as C0 80 and supplementary characters as two 3-byte
+    // surrogates; rewrite both in place the way String.getBytes("utf-8") would, the text only shrinks
+    size_t StandardUtf8(char *text, size_t size)
+    {
+        auto *bytes = reinterpret_cast<unsigned char *>(text);
+        // plain text has neither lead byte, two memchr keep that case at memory speed
+        const void *nul = memchr(text, 0xc0, size);
+        const void *surrogate = memchr(text, 0xed, size);
+        if (nul == nullptr && surrogate == nullptr) {
+            return size;
+        }
+        size_t in = size;
+        if (nul != nullptr) {
+            in = static_cast<const char *>(nul) - text;
+        }
+        if (surrogate != nullptr && static_cast<size_t>(static_cast<const char *>(surrogate) - text) < in) {
+            in = static_cast<const char *>(surrogate) - text;
+        }
+        size_t out = in;
+        while (in < size) {
+            unsigned char c = bytes[in];
+            if (c == 0xc0 && in + 1 < size && bytes[in + 1] == 0x80) {
+                bytes[out++] = 0;
+                in += 2;
+            } else if (c == 0xed && in + 5 < size && (bytes[in + 1] & 0xf0) == 0xa0
+                       && bytes[in + 3] == 0xed && (bytes[in + 4] & 0xf0) == 0xb0) {
+                uint32_t high = 0xd000 | ((bytes[in + 1] & 0x3fu) << 6) | (bytes[in + 2] & 0x3fu);
+                uint32_t low = 0xd000 | ((bytes[in + 4] & 0x3fu) << 6) | (bytes[in + 5] & 0x3fu);
+                uint32_t point = 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00);
+                bytes[out++] = static_cast<unsigned char>(0xf0 | (point >> 18));
+                bytes[out++] = static_cast<unsigned char>(0x80 | ((point >> 12) & 0x3f));
+                bytes[out++] = static_cast<unsigned char>(0x80 | ((point >> 6) & 0x3f));
+                bytes[out++] = static_cast<unsigned char>(0x80 | (point & 0x3f));
+                in += 6;
+            } else {
+                bytes[out++] = bytes[in++];
+            }
+        }
+        return out;
+    }
+
+    // the old Jstring2Cstring: a java byte[], a pinned copy, a malloc and a std::string
+    std::string LegacyString(JNIEnv *env, jstring jstr)
+    {
+        JniRegistry &registry = JniRegistry::instance();
+        auto barr = (jbyteArray) env->CallObjectMethod(jstr, registry.stringGetBytes, registry.utf8);
+        auto len = static_cast<size_t>(env->GetArrayLength(barr));
+        jbyte *ba = env->GetByteArrayElements(barr, JNI_FALSE);
+        char *rtn = (char *) malloc(len + 1);
+        memcpy(rtn, ba, len);
+        rtn[len] = 0;
+        env->ReleaseByteArrayElements(barr, ba, 0);
+        env->DeleteLocalRef(barr);
+        std::string temp(rtn, len);
+        free(rtn);
+        return temp;
+    }
+}
+
+JniString::JniString(JNIEnv *env, jstring string)
+{
+    Copy(env, string, m_inline, INLINE_SIZE);
+}
+
+JniString::JniString(JNIEnv *env, jstring string, char *buffer, size_t capacity)
+{
+    Copy(env, string, buffer, capacity);
+}
+
+JniString::~JniString()
+{
+    free(m_heap);
+}
+
+void JniString::Copy(JNIEnv *env, jstring string, char *buffer, size_t capacity)
+{
+    m_inline[0] = '\0';
+    if (string == nullptr) {
+        return;
+    }
+    auto size = static_cast<size_t>(env->GetStringUTFLength(string));
+    if (size + 1 > capacity) {
+        m_heap = static_cast<char *>(malloc(size + 1));
+        if (m_heap == nullptr) {
+            LOGE("no memory for a string of %zu bytes", size);
+            return;
+        }
+        buffer = m_heap;
+    }
+    // the region is counted in utf-16 units, the bytes it writes were measured above
+    env->GetStringUTFRegion(string, 0, env->GetStringLength(string), buffer);
+    m_size = StandardUtf8(buffer, size);
+    buffer[m_size] = '\0';
+    m_data = buffer;
+}
+
+void JniString::Benchmark(JNIEnv *env, int rounds)
+{
+    const char *texts[] = {"com.tsymiar.devidroid",
+                           "a payload well past the inline buffer, the kind Publish and sendKcpData carry: "
+                           "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"};
+    for (const char *text : texts) {
+        jstring string = env->NewStringUTF(text);
+        size_t bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            bytes += LegacyString(env, string).size();
+        }
+        double legacy = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            JniString view(env, string);
+            bytes += view.size();
+        }
+        double region = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        env->DeleteLocalRef(string);
+        LOGI("jni string of %zu bytes: getBytes %.0f ns, utf region %.0f ns per call (%zu).",
+             strlen(text), legacy / rounds, region / rounds, bytes);
+    }
+}
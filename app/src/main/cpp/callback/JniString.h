@@ -0,0 +1,47 @@
+#ifndef DEVIDROID_JNISTRING_H
+#define DEVIDROID_JNISTRING_H
+
+#include <jni.h>
+#include <cstddef>
+#include <string>
+
+// utf-8 view of a jstring, copied once with GetStringUTFRegion into an inline buffer,
+// a caller's buffer or, past both, the heap; a null jstring reads as ""
+class JniString {
+public:
+    static constexpr size_t INLINE_SIZE = 128;
+
+    JniString(JNIEnv *env, jstring string);
+
+    // 'buffer' is used when the text and its terminator fit in 'capacity'
+    JniString(JNIEnv *env, jstring string, char *buffer, size_t capacity);
+
+    ~JniString();
+
+    JniString(const JniString &) = delete;
+
+    JniString &operator=(const JniString &) = delete;
+
+    const char *data() const { return m_data; }
+
+    const char *c_str() const { return m_data; }
+
+    size_t size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    std::string str() const { return std::string(m_data, m_size); }
+
+    // getBytes("utf-8") + malloc + std::string against JniString, short and long texts
+    static void Benchmark(JNIEnv *env, int rounds = 10000);
+
+private:
+    void Copy(JNIEnv *env, jstring string, char *buffer, size_t capacity);
+
+    char m_inline[INLINE_SIZE];
+    char *m_data = m_inline;
+    char *m_heap = nullptr;
+    size_t m_size = 0;
+};
+
+#endif //DEVIDROID_JNISTRING_H
@@ -3,6 +3,7 @@
 #include <cerrno>
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
 
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
@@ -14,21 +15,22 @@
 #include <message/Message.h>
 #include <utils/statics.h>
 #include <files/bitmap.h>
+#include <callback/JniRegistry.h>
 
 extern ANativeWindow *g_nativeWindow;
 
-/** Classes and methods from JNI. */
+/** Objects from JNI, android.view.Surface and its methods are cached by JniRegistry. */
 namespace JNI {
-    /** android.view.Surface class */
-    static jclass surface_class;
-    /** android.view.Surface constructor */
-    static jmethodID surface_init;
-    /** android.view.Surface.release() */
-    static jmethodID surface_release;
     /** The surface and its native window. */
     static jobject surface_view{};
 }
 
+namespace {
+    /** Geometry drawFrame last gave the window, reset with the window. */
+    int g_frameWidth = 0;
+    int g_frameHeight = 0;
+}
+
 /**
  * Create surface for surface texture.
  *
@@ -39,12 +41,14 @@ void createSurface(JNIEnv *env, jobject texture)
 {
     jvalue params[1];
     params[0].l = texture;
-    auto surface = env->NewObjectA(JNI::surface_class, JNI::surface_init, params);
+    JniRegistry &registry = JniRegistry::instance();
+    auto surface = env->NewObjectA(registry.surfaceClass, registry.surfaceInit, params);
     if (surface == nullptr) {
         LOGE("Failed to construct surface");
         return;
     }
     JNI::surface_view = env->NewGlobalRef(surface);
+    env->DeleteLocalRef(surface);
 }
 
 /**
@@ -55,7 +59,7 @@ void createSurface(JNIEnv *env, jobject texture)
 void CpuRenderView::releaseSurfaceView(JNIEnv *env)
 {
     if (JNI::surface_view != nullptr) {
-        env->CallVoidMethod(JNI::surface_view, JNI::surface_release);
+        env->CallVoidMethod(JNI::surface_view, JniRegistry::instance().surfaceRelease);
         env->DeleteGlobalRef(JNI::surface_view);
         JNI::surface_view = nullptr;
     }
@@ -63,6 +67,8 @@ void CpuRenderView::releaseSurfaceView(JNIEnv *env)
         ANativeWindow_release(g_nativeWindow);
         g_nativeWindow = nullptr;
     }
+    g_frameWidth = 0;
+    g_frameHeight = 0;
 }
 
 void rebuildTexture(JNIEnv *env, jobject texture)
@@ -78,28 +84,16 @@ void rebuildTexture(JNIEnv *env, jobject texture)
 
 int CpuRenderView::setupSurfaceView(JNIEnv *env, jobject texture)
 {
-    jobject surface = env->FindClass("android/view/Surface");
-    if (surface == nullptr) {
+    JniRegistry &registry = JniRegistry::instance();
+    if (registry.surfaceClass == nullptr) {
         LOGE("Surface class can not be found");
         return 0;
-    } else {
-        jobject global = env->NewGlobalRef(surface);
-        JNI::surface_class = reinterpret_cast<jclass>(global);
-        if (JNI::surface_class == nullptr) {
-            LOGE("Surface reference cast with error");
-            return 0;
-        }
     }
-
-    JNI::surface_init = env->GetMethodID(JNI::surface_class, "<init>",
-                                         "(Landroid/graphics/SurfaceTexture;)V");
-    if (JNI::surface_init == nullptr) {
+    if (registry.surfaceInit == nullptr) {
         LOGE("SurfaceTexture constructor got fail");
         return 0;
     }
-
-    JNI::surface_release = env->GetMethodID(JNI::surface_class, "release", "()V");
-    if (JNI::surface_release == nullptr) {
+    if (registry.surfaceRelease == nullptr) {
         LOGE("Surface.release() method got fail");
         return 0;
     }
@@ -273,3 +267,72 @@ void CpuRenderView::drawSurface(uint8_t *data, size_t size)
         LOGE("Unable to unlock and post to native window");
     }
 }
+
+namespace {
+    inline uint8_t Clamp(int value)
+    {
+        return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+
+    // bt.601 limited range to RGBA_8888, read straight from the planes into the window buffer
+    void YuvToRgba(const FramePlanes &frame, uint8_t *bits, int stride)
+    {
+        for (int row = 0; row < frame.height; row++) {
+            const uint8_t *y = frame.y + static_cast<size_t>(row) * frame.yStride;
+            size_t chroma = static_cast<size_t>(row / 2) * frame.uvStride;
+            const uint8_t *u = frame.u + chroma;
+            const uint8_t *v = frame.v + chroma;
+            auto *pixel = reinterpret_cast<uint32_t *>(bits + static_cast<size_t>(row) * stride * 4);
+            for (int col = 0; col < frame.width; col++) {
+                int offset = (col / 2) * frame.uvPixelStride;
+                int c = 298 * (y[col] - 16) + 128;
+                int d = u[offset] - 128;
+                int e = v[offset] - 128;
+                uint32_t r = Clamp((c + 409 * e) >> 8);
+                uint32_t g = Clamp((c - 100 * d - 208 * e) >> 8);
+                uint32_t b = Clamp((c + 516 * d) >> 8);
+                pixel[col] = r | (g << 8) | (b << 16) | 0xff000000u;
+            }
+        }
+    }
+}
+
+bool CpuRenderView::drawFrame(const FramePlanes &frame)
+{
+    if (g_nativeWindow == nullptr) {
+        LOGE("NativeWindow nullptr error");
+        return false;
+    }
+    if (frame.y == nullptr || frame.u == nullptr || frame.v == nullptr
+        || frame.width <= 0 || frame.height <= 0) {
+        return false;
+    }
+    // only a size change reconfigures the window, the compositor scales it to the view
+    if (frame.width != g_frameWidth || frame.height != g_frameHeight) {
+        if (ANativeWindow_setBuffersGeometry(g_nativeWindow, frame.width, frame.height,
+                                             WINDOW_FORMAT_RGBA_8888) != 0) {
+            LOGE("Failed to set buffers geometry");
+            return false;
+        }
+        g_frameWidth = frame.width;
+        g_frameHeight = frame.height;
+    }
+    ANativeWindow_Buffer buffer;
+    if (ANativeWindow_lock(g_nativeWindow, &buffer, nullptr) < 0) {
+        LOGE("Native window may busy");
+        return false;
+    }
+    if (buffer.format == WINDOW_FORMAT_RGBA_8888 || buffer.format == WINDOW_FORMAT_RGBX_8888) {
+        FramePlanes visible = frame;
+        visible.width = std::min(frame.width, static_cast<int>(buffer.width));
+        visible.height = std::min(frame.height, static_cast<int>(buffer.height));
+        YuvToRgba(visible, static_cast<uint8_t *>(buffer.bits), buffer.stride);
+    } else {
+        LOGE("window format %d is not RGBA", buffer.format);
+    }
+    if (ANativeWindow_unlockAndPost(g_nativeWindow) < 0) {
+        LOGE("Unable to unlock and post to native window");
+        return false;
+    }
+    return true;
+}
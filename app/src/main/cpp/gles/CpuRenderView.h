@@ -2,6 +2,7 @@
 #define DEVIDROID_CPURENDERVIEW_H
 
 #include <jni.h>
+#include "FrameRing.h"
 
 namespace CpuRenderView {
     int setupSurfaceView(JNIEnv *env, jobject texture);
@@ -13,6 +14,9 @@ namespace CpuRenderView {
     void drawRGBColor(uint32_t color, const char *filename = nullptr);
 
     void drawSurface(uint8_t *data, size_t size = 0);
+
+    // converts the planes into the locked window buffer, the only copy the frame sees
+    bool drawFrame(const FramePlanes &frame);
 }
 
 #endif //DEVIDROID_CPURENDERVIEW_H
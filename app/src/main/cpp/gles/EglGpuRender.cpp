@@ -680,3 +680,91 @@ void EglGpuRender::FrameRender(unsigned char* frameData, size_t)
 
     glUseProgram(NULL);
 }
+
+namespace {
+    typedef EGLBoolean (*PresentationTime)(EGLDisplay, EGLSurface, EGLnsecsANDROID);
+
+    // one plane into 'texture': a single upload when rows are tight, else row by row
+    // since es2 has no GL_UNPACK_ROW_LENGTH
+    void UploadPlane(GLenum unit, GLuint texture, GLenum format, int width, int height,
+                     const uint8_t *data, int stride, int bytes)
+    {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (stride == width * bytes) {
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+            return;
+        }
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+        for (int row = 0; row < height; row++) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, width, 1, format, GL_UNSIGNED_BYTE,
+                            data + static_cast<size_t>(row) * stride);
+        }
+    }
+}
+
+bool EglGpuRender::RenderPlanes(const FramePlanes &frame)
+{
+    if (frame.y == nullptr || frame.u == nullptr || frame.v == nullptr
+        || frame.width <= 0 || frame.height <= 0 || EGL2.eglSurface == nullptr) {
+        return false;
+    }
+    if (frame.uvPixelStride == 2 && frame.u - frame.v != 1 && frame.v - frame.u != 1) {
+        LOGE("pixel stride 2 chroma must interleave u and v");
+        return false;
+    }
+    EGL2.width = static_cast<GLuint>(frame.width);
+    EGL2.height = static_cast<GLuint>(frame.height);
+    int chromaWidth = (frame.width + 1) / 2;
+    int chromaHeight = (frame.height + 1) / 2;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    UploadPlane(GL_TEXTURE0, g_Texture2D[Y], GL_LUMINANCE, frame.width, frame.height,
+                frame.y, frame.yStride, 1);
+    GLfloat uChannel = 0.0f;
+    GLfloat vChannel = 0.0f;
+    if (frame.uvPixelStride == 2) {
+        // interleaved chroma goes up as one luminance-alpha texture, the shader picks its channels
+        const uint8_t *chroma = frame.u < frame.v ? frame.u : frame.v;
+        UploadPlane(GL_TEXTURE1, g_Texture2D[U], GL_LUMINANCE_ALPHA, chromaWidth, chromaHeight,
+                    chroma, frame.uvStride, 2);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, g_Texture2D[U]);
+        uChannel = frame.u < frame.v ? 0.0f : 1.0f;
+        vChannel = 1.0f - uChannel;
+    } else {
+        UploadPlane(GL_TEXTURE1, g_Texture2D[U], GL_LUMINANCE, chromaWidth, chromaHeight,
+                    frame.u, frame.uvStride, 1);
+        UploadPlane(GL_TEXTURE2, g_Texture2D[V], GL_LUMINANCE, chromaWidth, chromaHeight,
+                    frame.v, frame.uvStride, 1);
+    }
+
+    glUseProgram(EGL2.glProgram);
+    glUniform1f(glGetUniformLocation(EGL2.glProgram, "Uchannel"), uChannel);
+    glUniform1f(glGetUniformLocation(EGL2.glProgram, "Vchannel"), vChannel);
+    glBindBuffer(GL_ARRAY_BUFFER, g_vertexPosBuffer);
+    GLint posLoc = glGetAttribLocation(EGL2.glProgram, "position");
+    glEnableVertexAttribArray(posLoc);
+    glVertexAttribPointer(posLoc, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, g_texturePosBuffer);
+    GLint texcoordLoc = glGetAttribLocation(EGL2.glProgram, "texCoord");
+    glEnableVertexAttribArray(texcoordLoc);
+    glVertexAttribPointer(texcoordLoc, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glDisableVertexAttribArray(posLoc);
+    glDisableVertexAttribArray(texcoordLoc);
+    glUseProgram(0);
+
+    // let the compositor pace the frame by its capture time where the driver supports it
+    static auto presentationTime = reinterpret_cast<PresentationTime>(
+            eglGetProcAddress("eglPresentationTimeANDROID"));
+    if (presentationTime != nullptr && frame.timestamp > 0) {
+        presentationTime(EGL2.eglDisplay, EGL2.eglSurface, frame.timestamp);
+    }
+    if (eglSwapBuffers(EGL2.eglDisplay, EGL2.eglSurface) == EGL_FALSE) {
+        LOGE("eglSwapBuffers fail with 0x%x", eglGetError());
+        return false;
+    }
+    return true;
+}
@@ -9,6 +9,7 @@
 #include <GLES2/gl2.h>
 #include <EGL/eglext.h>
 #include <android/native_window.h>
+#include "FrameRing.h"
 
 /** OpenGL stuff. */
 struct EGL2 {
@@ -57,6 +58,9 @@ namespace EglGpuRender {
     int DrawRGBTexture(const char* filename);
 
     void FrameRender(unsigned char* frameData, size_t);
+
+    // draws planes straight from the caller's memory with the current context, then swaps
+    bool RenderPlanes(const FramePlanes &frame);
 }
 
 #endif //DEVIDROID_EGLGPURENDER_H
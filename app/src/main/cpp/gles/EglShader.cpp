@@ -32,13 +32,18 @@ const char* g_fragmentShader =
                 "uniform sampler2D Ytexture; "
                 "uniform sampler2D Utexture; "
                 "uniform sampler2D Vtexture; "
+                // 0 samples luminance, 1 alpha: an interleaved (NV21) chroma plane is bound to both
+                "uniform float Uchannel; "
+                "uniform float Vchannel; "
                 "void main() "
                 "{ "
                 "    float r,g,b,y,u,v; "
 
                 "    y=texture2D(Ytexture, coord.st).r; "
-                "    u=texture2D(Utexture, coord.st).r; "
-                "    v=texture2D(Vtexture, coord.st).r; "
+                "    vec4 uc=texture2D(Utexture, coord.st); "
+                "    vec4 vc=texture2D(Vtexture, coord.st); "
+                "    u=mix(uc.r, uc.a, Uchannel); "
+                "    v=mix(vc.r, vc.a, Vchannel); "
 
                 "    y=1.1643*(y-0.0625); "
                 "    u=u-0.5; "
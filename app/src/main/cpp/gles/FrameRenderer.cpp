@@ -0,0 +1,166 @@
+#ifndef LOG_TAG
+#define LOG_TAG "FrameRenderer"
+#endif
+
+#include "FrameRenderer.h"
+#include "CpuRenderView.h"
+#include "EglGpuRender.h"
+#include "EglShader.h"
+#include "EglTexture.h"
+#include <Utils/logging.h>
+#include <message/Message.h>
+
+extern EGL2 EGL2;
+
+FrameRenderer& FrameRenderer::instance()
+{
+    static FrameRenderer renderer;
+    return renderer;
+}
+
+FrameRenderer::~FrameRenderer()
+{
+    Stop();
+}
+
+bool FrameRenderer::Attach(JNIEnv *env, jobject texture, bool gpu)
+{
+    Detach(env);
+    if (CpuRenderView::setupSurfaceView(env, texture) <= 0) {
+        LOGE("frame surface can not be set up");
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_stop = false;
+    m_ready = 0;
+    m_lastTimestamp = 0;
+    m_running = true;
+    m_thread = std::thread(&FrameRenderer::Loop, this, gpu);
+    m_work.wait(lock, [this] { return m_ready != 0; });
+    bool ready = m_ready > 0;
+    lock.unlock();
+    if (!ready) {
+        Detach(env);
+        Message::instance().setMessage("frame surface setup fail!", TOAST);
+    }
+    return ready;
+}
+
+void FrameRenderer::Detach(JNIEnv *env)
+{
+    Stop();
+    CpuRenderView::releaseSurfaceView(env);
+}
+
+void FrameRenderer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_work.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool FrameRenderer::Submit(int index, int width, int height, int format, int64_t timestamp)
+{
+    FrameRing &ring = FrameRing::instance();
+    if (!ring.Acquired(index)) {
+        LOGE("frame %d was not acquired", index);
+        return false;
+    }
+    Job job{};
+    if (!FramePlanes::Packed(job.planes, ring.Data(index), ring.Size(), width, height, format)) {
+        ring.Release(index);
+        return false;
+    }
+    job.planes.timestamp = timestamp;
+    job.index = index;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            ring.Release(index);
+            return false;
+        }
+        job.sequence = ++m_queued;
+        m_jobs.push_back(job);
+    }
+    m_work.notify_all();
+    return true;
+}
+
+bool FrameRenderer::Render(const FramePlanes &frame)
+{
+    bool drawn = false;
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (!m_running) {
+        return false;
+    }
+    uint64_t sequence = ++m_queued;
+    m_jobs.push_back(Job{frame, -1, sequence, &drawn});
+    m_work.notify_all();
+    m_done.wait(lock, [this, sequence] { return m_finished >= sequence || !m_running; });
+    return drawn;
+}
+
+void FrameRenderer::Loop(bool gpu)
+{
+    bool ready = true;
+    if (gpu) {
+        // the context is made current here and stays on this thread until CloseGLSurface
+        ready = EglGpuRender::OpenGLSurface() != nullptr;
+        if (ready) {
+            EGL2.glProgram = EglShader::GetShaderProgram();
+            EglTexture::SetTextureBuffers(EGL2.glProgram);
+        }
+    }
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_ready = ready ? 1 : -1;
+    m_work.notify_all();
+    while (ready) {
+        m_work.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+        if (m_stop) {
+            break;
+        }
+        Job job = m_jobs.front();
+        m_jobs.pop_front();
+        int64_t timestamp = job.planes.timestamp;
+        // a newer ring frame is already waiting, or this one is older than what is on screen
+        bool superseded = job.index >= 0 && !m_jobs.empty() && m_jobs.front().index >= 0;
+        bool stale = timestamp > 0 && timestamp <= m_lastTimestamp;
+        bool drawn = false;
+        if (superseded || stale) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            lock.unlock();
+            drawn = gpu ? EglGpuRender::RenderPlanes(job.planes) : CpuRenderView::drawFrame(job.planes);
+            lock.lock();
+            if (drawn && timestamp > 0) {
+                m_lastTimestamp = timestamp;
+            }
+        }
+        if (job.index >= 0) {
+            FrameRing::instance().Release(job.index);
+        }
+        if (job.drawn != nullptr) {
+            *job.drawn = drawn;
+        }
+        m_finished = job.sequence;
+        m_done.notify_all();
+    }
+    for (const Job &job : m_jobs) {
+        if (job.index >= 0) {
+            FrameRing::instance().Release(job.index);
+        }
+    }
+    m_jobs.clear();
+    m_finished = m_queued;
+    m_running = false;
+    m_done.notify_all();
+    lock.unlock();
+    if (gpu && ready) {
+        EglGpuRender::CloseGLSurface();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef DEVIDROID_FRAMERENDERER_H
+#define DEVIDROID_FRAMERENDERER_H
+
+#include <jni.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "FrameRing.h"
+
+// draws frames pushed from java onto one surface texture, by cpu into the native window or
+// by es2 on a render thread that owns the egl context; frames are read where they lie
+class FrameRenderer {
+public:
+    static FrameRenderer& instance();
+
+    // replaces the surface drawn to so far, false if the window or gl setup fails
+    bool Attach(JNIEnv *env, jobject texture, bool gpu);
+
+    void Detach(JNIEnv *env);
+
+    // queues an acquired ring slot holding a packed frame and returns, the slot is released
+    // once drawn or skipped; a renderer running behind skips to the newest slot
+    bool Submit(int index, int width, int height, int format, int64_t timestamp);
+
+    // draws planes that stay owned by the caller, returns after they have been read
+    bool Render(const FramePlanes &frame);
+
+    // frames skipped as stale or superseded
+    uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    FrameRenderer() = default;
+
+    ~FrameRenderer();
+
+    struct Job {
+        FramePlanes planes;
+        int index;
+        uint64_t sequence;
+        // set by the render thread for a waiting Render
+        bool *drawn;
+    };
+
+    void Loop(bool gpu);
+
+    // stops the render thread, releasing the slots it had queued
+    void Stop();
+
+    std::mutex m_lock;
+    std::condition_variable m_work;
+    std::condition_variable m_done;
+    std::deque<Job> m_jobs;
+    std::thread m_thread;
+    bool m_running = false;
+    bool m_stop = false;
+    int m_ready = 0;
+    uint64_t m_queued = 0;
+    uint64_t m_finished = 0;
+    int64_t m_lastTimestamp = 0;
+    std::atomic<uint64_t> m_dropped{0};
+};
+
+#endif //DEVIDROID_FRAMERENDERER_H
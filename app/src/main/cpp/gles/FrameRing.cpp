@@ -0,0 +1,169 @@
+#ifndef LOG_TAG
+#define LOG_TAG "FrameRing"
+#endif
+
+#include "FrameRing.h"
+#include <cstdlib>
+#include <Utils/logging.h>
+
+namespace {
+    // slots start on a cache line, a gpu upload or a memcpy from them never straddles one needlessly
+    constexpr size_t FRAME_ALIGN = 64;
+}
+
+size_t FramePlanes::PackedSize(int width, int height)
+{
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+    size_t chroma = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+    return static_cast<size_t>(width) * height + chroma * 2;
+}
+
+bool FramePlanes::Packed(FramePlanes &planes, const uint8_t *data, size_t size,
+                         int width, int height, int format)
+{
+    size_t need = PackedSize(width, height);
+    if (data == nullptr || need == 0 || size < need) {
+        return false;
+    }
+    int chromaWidth = (width + 1) / 2;
+    const uint8_t *chroma = data + static_cast<size_t>(width) * height;
+    size_t plane = static_cast<size_t>(chromaWidth) * ((height + 1) / 2);
+    planes.y = data;
+    planes.yStride = width;
+    planes.width = width;
+    planes.height = height;
+    switch (format) {
+        case FRAME_I420:
+            planes.u = chroma;
+            planes.v = chroma + plane;
+            planes.uvStride = chromaWidth;
+            planes.uvPixelStride = 1;
+            return true;
+        case FRAME_YV12:
+            planes.v = chroma;
+            planes.u = chroma + plane;
+            planes.uvStride = chromaWidth;
+            planes.uvPixelStride = 1;
+            return true;
+        case FRAME_NV21:
+            planes.v = chroma;
+            planes.u = chroma + 1;
+            planes.uvStride = chromaWidth * 2;
+            planes.uvPixelStride = 2;
+            return true;
+        default:
+            LOGE("frame format 0x%x is not supported", format);
+            return false;
+    }
+}
+
+FrameRing& FrameRing::instance()
+{
+    static FrameRing ring;
+    return ring;
+}
+
+FrameRing::~FrameRing()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    Retire();
+    for (uint8_t *data : m_retired) {
+        free(data);
+    }
+    m_retired.clear();
+}
+
+void FrameRing::Retire()
+{
+    for (int i = 0; i < m_count; i++) {
+        m_retired.push_back(m_slots[i].data);
+    }
+    m_slots.reset();
+    m_count = 0;
+    m_size = 0;
+}
+
+bool FrameRing::Allocate(int count, size_t size)
+{
+    if (count <= 0 || size == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (int i = 0; i < m_count; i++) {
+        if (m_slots[i].busy.load(std::memory_order_acquire)) {
+            LOGE("frame %d is still in flight, ring not reallocated", i);
+            return false;
+        }
+    }
+    std::unique_ptr<Slot[]> slots(new Slot[count]);
+    for (int i = 0; i < count; i++) {
+        void *data = nullptr;
+        if (posix_memalign(&data, FRAME_ALIGN, size) != 0) {
+            LOGE("no memory for frame %d of %zu bytes", i, size);
+            for (int j = 0; j < i; j++) {
+                free(slots[j].data);
+            }
+            return false;
+        }
+        slots[i].data = static_cast<uint8_t *>(data);
+    }
+    if (m_count > 0) {
+        LOGI("frame ring of %d x %zu bytes retired", m_count, m_size);
+    }
+    Retire();
+    m_slots = std::move(slots);
+    m_count = count;
+    m_size = size;
+    m_cursor.store(0, std::memory_order_relaxed);
+    LOGI("frame ring of %d x %zu bytes", count, size);
+    return true;
+}
+
+int FrameRing::Acquire()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    // start past the last handed out slot so every buffer gets reused in turn
+    unsigned start = m_cursor.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < m_count; i++) {
+        int index = static_cast<int>((start + i) % m_count);
+        bool busy = false;
+        if (m_slots[index].busy.compare_exchange_strong(busy, true, std::memory_order_acquire)) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+void FrameRing::Release(int index)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (index >= 0 && index < m_count) {
+        m_slots[index].busy.store(false, std::memory_order_release);
+    }
+}
+
+bool FrameRing::Acquired(int index) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return index >= 0 && index < m_count && m_slots[index].busy.load(std::memory_order_acquire);
+}
+
+uint8_t *FrameRing::Data(int index) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return index >= 0 && index < m_count ? m_slots[index].data : nullptr;
+}
+
+size_t FrameRing::Size() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_size;
+}
+
+int FrameRing::Count() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_count;
+}
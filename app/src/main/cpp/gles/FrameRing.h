@@ -0,0 +1,85 @@
+#ifndef DEVIDROID_FRAMERING_H
+#define DEVIDROID_FRAMERING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// android.graphics.ImageFormat values of the packed layouts a ring slot can hold
+enum FrameFormat {
+    FRAME_NV21 = 0x11,
+    FRAME_I420 = 0x23,
+    FRAME_YV12 = 0x32315659
+};
+
+// one yuv 4:2:0 frame as pointers into memory owned by someone else: u and v may interleave
+// (uvPixelStride 2, NV21 when v comes first), rows may be padded past the width
+struct FramePlanes {
+    const uint8_t *y = nullptr;
+    const uint8_t *u = nullptr;
+    const uint8_t *v = nullptr;
+    int yStride = 0;
+    int uvStride = 0;
+    int uvPixelStride = 1;
+    int width = 0;
+    int height = 0;
+    int64_t timestamp = 0;
+
+    // planes of a packed frame in 'data', false if 'size' is too small for the format
+    static bool Packed(FramePlanes &planes, const uint8_t *data, size_t size,
+                       int width, int height, int format);
+
+    // bytes a packed frame of this size takes
+    static size_t PackedSize(int width, int height);
+};
+
+// natively owned frame buffers handed to java as direct ByteBuffers: a producer acquires
+// a free slot, fills it and submits it, the renderer releases it after drawing
+class FrameRing {
+public:
+    static FrameRing& instance();
+
+    // 'count' slots of 'size' bytes, replaces the previous ones; false while any slot is
+    // still acquired. java may still hold the old blocks as direct buffers, so they are
+    // retired rather than freed and only go with the ring
+    bool Allocate(int count, size_t size);
+
+    // index of a free slot now owned by the caller, -1 when all are in flight
+    int Acquire();
+
+    void Release(int index);
+
+    bool Acquired(int index) const;
+
+    uint8_t *Data(int index) const;
+
+    size_t Size() const;
+
+    int Count() const;
+
+private:
+    FrameRing() = default;
+
+    ~FrameRing();
+
+    struct Slot {
+        uint8_t *data = nullptr;
+        std::atomic<bool> busy{false};
+    };
+
+    // m_lock held
+    void Retire();
+
+    // every read of the slot table is under it, Allocate swaps the table
+    mutable std::mutex m_lock;
+    std::unique_ptr<Slot[]> m_slots;
+    std::vector<uint8_t *> m_retired;
+    int m_count = 0;
+    size_t m_size = 0;
+    std::atomic<unsigned> m_cursor{0};
+};
+
+#endif //DEVIDROID_FRAMERING_H
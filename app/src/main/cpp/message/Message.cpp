@@ -3,31 +3,460 @@
 //
 
 #include "Message.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
 
-std::queue <Messaging> Message::m_msgQue;
+#ifndef LOG_TAG
+#define LOG_TAG "Message"
+#endif
+
+#include <Utils/logging.h>
+
+constexpr size_t Message::CAPACITY;
+
+namespace {
+    // heap calls made by the strings of PayloadBenchmark's old-style producer
+    std::atomic<uint64_t> g_allocations(0);
+
+    template<typename T>
+    struct CountingAllocator : std::allocator<T> {
+        template<typename U>
+        struct rebind {
+            typedef CountingAllocator<U> other;
+        };
+
+        CountingAllocator() = default;
+
+        template<typename U>
+        CountingAllocator(const CountingAllocator<U> &) {}
+
+        T *allocate(size_t n)
+        {
+            g_allocations.fetch_add(1, std::memory_order_relaxed);
+            return std::allocator<T>::allocate(n);
+        }
+    };
+
+    typedef std::basic_string<char, std::char_traits<char>, CountingAllocator<char>> CountedString;
+}
+
+static_assert((Message::CAPACITY & (Message::CAPACITY - 1)) == 0, "capacity must be a power of 2");
+
+Message::Message() : m_head(0), m_tail(0), m_overflow(DROP_OLDEST), m_sleeping(false)
+{
+    // slot i is free for the producer of position i
+    for (size_t i = 0; i < CAPACITY; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    for (auto &dropped : m_dropped) {
+        dropped.store(0, std::memory_order_relaxed);
+    }
+}
+
+Message& Message::instance()
+{
+    static Message message;
+    return message;
+}
+
+// bounded mpmc ring of D. Vyukov: each slot's sequence says whose turn it is,
+// producers drop the oldest by taking a slot like the consumer does
+Message::Slot *Message::reserve(MASSAGER massager, size_t &pos)
+{
+    int wait = 0;
+    while (true) {
+        pos = m_head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot *slot = &m_slots[pos & (CAPACITY - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot->massager = massager;
+                    return slot;
+                }
+            } else if (diff < 0) {
+                break;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        int overflow = m_overflow.load(std::memory_order_relaxed);
+        if (overflow == DROP_NEWEST) {
+            m_dropped[massager].fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else if (overflow == DROP_OLDEST) {
+            size_t oldest;
+            Slot *slot = take(oldest);
+            if (slot != nullptr) {
+                m_dropped[slot->massager].fetch_add(1, std::memory_order_relaxed);
+                release(slot, oldest);
+            }
+        } else if (++wait < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void Message::commit(Slot *slot, size_t pos)
+{
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    wake();
+}
+
+Message::Slot *Message::take(size_t &pos)
+{
+    pos = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+        Slot *slot = &m_slots[pos & (CAPACITY - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return slot;
+            }
+        } else if (diff < 0) {
+            return nullptr;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Message::release(Slot *slot, size_t pos)
+{
+    // spill is cleared but not shrunk, a slot that once held a long text can hold it again for free
+    slot->spill.clear();
+    slot->sequence.store(pos + CAPACITY, std::memory_order_release);
+}
+
+bool Message::readable() const
+{
+    if (m_carried) {
+        return true;
+    }
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    return m_slots[pos & (CAPACITY - 1)].sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+// pairs with the fence in waitMessages: either the consumer sees the new slot
+// before parking, or the producer sees it parked and signals under the lock
+void Message::wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_waitLock);
+        m_wakeup.notify_one();
+    }
+}
+
+bool Message::waitMessages(int timeoutMs)
+{
+    if (readable()) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(m_waitLock);
+    m_sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ready;
+    if (timeoutMs < 0) {
+        m_wakeup.wait(lock, [this]() { return readable(); });
+        ready = true;
+    } else {
+        ready = m_wakeup.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                  [this]() { return readable(); });
+    }
+    m_sleeping.store(false, std::memory_order_relaxed);
+    return ready;
+}
 
 Messaging Message::getMessage()
 {
     Messaging messaging{};
-    if (m_msgQue.empty())
+    if (m_carried) {
+        m_carried = false;
+        messaging = m_carry;
         return messaging;
-    messaging = m_msgQue.front();
-    if (!messaging.message.empty()) {
-        m_msgQue.pop();
+    }
+    size_t pos;
+    Slot *slot = take(pos);
+    if (slot != nullptr) {
+        messaging.massager = slot->massager;
+        messaging.message.assign(slot->data(), slot->length);
+        release(slot, pos);
     }
     return messaging;
 }
 
-Message& Message::instance()
+size_t Message::drainMessages(char *buffer, size_t capacity, size_t max)
 {
-    static Message message;
-    return message;
+    const size_t header = 2 * sizeof(int32_t);
+    size_t count = 0;
+    size_t offset = 0;
+    while (count < max) {
+        // copied straight out of the slot, only a message left over from the last call comes from m_carry
+        size_t pos = 0;
+        Slot *slot = nullptr;
+        MASSAGER massager;
+        const char *data;
+        size_t length;
+        if (m_carried) {
+            massager = m_carry.massager;
+            data = m_carry.message.data();
+            length = m_carry.message.size();
+        } else if ((slot = take(pos)) != nullptr) {
+            massager = slot->massager;
+            data = slot->data();
+            length = slot->length;
+        } else {
+            break;
+        }
+        if (offset + header + length > capacity) {
+            if (count > 0 || capacity < header) {
+                if (slot != nullptr) {
+                    m_carry.massager = massager;
+                    m_carry.message.assign(data, length);
+                    m_carried = true;
+                    release(slot, pos);
+                }
+                break;
+            }
+            // larger than the whole buffer, cut at a utf-8 character boundary
+            length = capacity - header;
+            while (length > 0 && (data[length] & 0xc0) == 0x80) {
+                length--;
+            }
+        }
+        int32_t fields[2] = {static_cast<int32_t>(massager), static_cast<int32_t>(length)};
+        memcpy(buffer + offset, fields, header);
+        memcpy(buffer + offset + header, data, length);
+        offset += header + length;
+        if (slot != nullptr) {
+            release(slot, pos);
+        } else {
+            m_carried = false;
+        }
+        count++;
+    }
+    return count;
+}
+
+bool Message::setMessage(const std::string& message, MASSAGER massager)
+{
+    return setMessage(message.data(), message.size(), massager);
+}
+
+bool Message::setMessage(const char *message, MASSAGER massager)
+{
+    return setMessage(message, strlen(message), massager);
+}
+
+bool Message::setMessage(const char *data, size_t length, MASSAGER massager)
+{
+    size_t pos;
+    Slot *slot = reserve(massager, pos);
+    if (slot == nullptr) {
+        return false;
+    }
+    if (length < MESSAGE_INLINE) {
+        memcpy(slot->text, data, length);
+        slot->text[length] = '\0';
+    } else {
+        slot->spill.assign(data, length);
+    }
+    slot->length = length;
+    commit(slot, pos);
+    return true;
+}
+
+bool Message::formatMessage(MASSAGER massager, const char *format, ...)
+{
+    size_t pos;
+    Slot *slot = reserve(massager, pos);
+    if (slot == nullptr) {
+        return false;
+    }
+    va_list args;
+    va_start(args, format);
+    va_list again;
+    va_copy(again, args);
+    int length = vsnprintf(slot->text, MESSAGE_INLINE, format, args);
+    if (length < 0) {
+        length = 0;
+        slot->text[0] = '\0';
+    } else if ((size_t) length >= MESSAGE_INLINE) {
+        slot->spill.resize((size_t) length + 1);
+        vsnprintf(&slot->spill[0], slot->spill.size(), format, again);
+        slot->spill.resize((size_t) length);
+    }
+    va_end(again);
+    va_end(args);
+    slot->length = (size_t) length;
+    commit(slot, pos);
+    return true;
 }
 
-void Message::setMessage(const std::string& message, MASSAGER massager)
+void Message::setOverflow(MessageOverflow overflow)
 {
-    Messaging messaging;
-    messaging.massager = massager;
-    messaging.message = message;
-    m_msgQue.emplace(messaging);
+    m_overflow.store(overflow, std::memory_order_relaxed);
+}
+
+uint64_t Message::dropped(MASSAGER massager) const
+{
+    return m_dropped[massager].load(std::memory_order_relaxed);
+}
+
+size_t Message::size() const
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+}
+
+void Message::Benchmark(int producers, int count, MessageOverflow overflow)
+{
+    Message *queue = new Message();
+    queue->setOverflow(overflow);
+    std::atomic<int> running(producers);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([queue, &running, p, count]() {
+            for (int i = 0; i < count; i++) {
+                queue->formatMessage(static_cast<MASSAGER>(p % MASSAGER_COUNT), "%d %d", p, i);
+            }
+            running--;
+        });
+    }
+    // every producer's messages must come out in the order it sent them
+    std::vector<int> last(producers, -1);
+    uint64_t received = 0;
+    uint64_t disorder = 0;
+    while (true) {
+        bool done = running.load() == 0;
+        size_t pos;
+        Slot *slot = queue->take(pos);
+        if (slot == nullptr) {
+            if (done) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        int p = 0;
+        int i = 0;
+        if (sscanf(slot->data(), "%d %d", &p, &i) != 2 || p < 0 || p >= producers || i <= last[p]) {
+            disorder++;
+        } else {
+            last[p] = i;
+        }
+        queue->release(slot, pos);
+        received++;
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+    uint64_t dropped = 0;
+    for (int m = 0; m < MASSAGER_COUNT; m++) {
+        dropped += queue->dropped(static_cast<MASSAGER>(m));
+    }
+    LOGI("message queue: %d producers x %d, %llu received, %llu dropped, %llu out of order, %.0f ns per message.",
+         producers, count, (unsigned long long) received, (unsigned long long) dropped,
+         (unsigned long long) disorder, elapsed * 1000 / ((double) producers * count));
+    delete queue;
+}
+
+void Message::WakeBenchmark(int rounds)
+{
+    Message *queue = new Message();
+    std::vector<double> latency;
+    latency.reserve(rounds);
+    std::thread consumer([queue, rounds, &latency]() {
+        size_t pos;
+        Slot *slot;
+        while ((int) latency.size() < rounds) {
+            if (!queue->waitMessages(1000)) {
+                break;
+            }
+            while ((slot = queue->take(pos)) != nullptr) {
+                long long sent = 0;
+                sscanf(slot->data(), "%lld", &sent);
+                queue->release(slot, pos);
+                auto now = std::chrono::steady_clock::now().time_since_epoch();
+                latency.push_back((double) (std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()
+                                            - sent) / 1000);
+            }
+        }
+    });
+    for (int i = 0; i < rounds; i++) {
+        // give the consumer time to park so every message takes the wakeup path
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        queue->formatMessage(MESSAGE, "%lld",
+                             (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    }
+    consumer.join();
+    // an idle consumer should burn next to no cpu while parked
+    struct timespec begin{};
+    struct timespec end{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+    queue->waitMessages(200);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    double idle = (double) (end.tv_sec - begin.tv_sec) * 1e6 + (double) (end.tv_nsec - begin.tv_nsec) / 1000;
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    LOGI("message wakeup: %zu/%d woken, latency p50 %.1f us, p99 %.1f us, max %.1f us, %.1f us cpu in 200ms idle.",
+         n, rounds, n ? latency[n / 2] : 0.0, n ? latency[n * 99 / 100] : 0.0, n ? latency[n - 1] : 0.0, idle);
+    delete queue;
+}
+
+void Message::PayloadBenchmark(int count)
+{
+    // what RecvHook and friends used to push: topic, status and content glued into a std::string
+    const char *topic = "device/status";
+    const char *status = "ok";
+    const char *content = "battery 87%, wifi -52 dBm, uptime 3d";
+    Message *queue = new Message();
+    std::vector<char> buffer(64 * 1024);
+    double nanos[2] = {};
+    uint64_t allocations[2] = {};
+    uint64_t spilled = 0;
+    for (int round = 0; round < 2; round++) {
+        g_allocations.store(0);
+        // fill the ring, time only the producer side, then drain it untimed
+        for (int sent = 0; sent < count;) {
+            int burst = std::min(count - sent, (int) CAPACITY);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < burst; i++) {
+                if (round == 0) {
+                    CountedString message = CountedString("header:\t[") + topic + "]\npayload:\t[" + status
+                                            + "]\t[" + content + "].";
+                    queue->setMessage(message.data(), message.size(), MESSAGE);
+                } else {
+                    queue->formatMessage(MESSAGE, "header:\t[%s]\npayload:\t[%s]\t[%s].", topic, status, content);
+                }
+            }
+            nanos[round] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            while (queue->drainMessages(buffer.data(), buffer.size(), CAPACITY) > 0) {}
+            sent += burst;
+        }
+        allocations[round] = g_allocations.load();
+    }
+    for (auto &slot : queue->m_slots) {
+        spilled += slot.spill.capacity() > std::string().capacity() ? 1 : 0;
+    }
+    LOGI("message payload: %d messages, string %.0f ns / %.2f allocs, inline %.0f ns / %.2f allocs, %llu slots spilled.",
+         count, nanos[0] / count, (double) allocations[0] / count, nanos[1] / count, (double) allocations[1] / count,
+         (unsigned long long) spilled);
+    delete queue;
 }
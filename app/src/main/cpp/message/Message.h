@@ -5,8 +5,12 @@
 #ifndef DEVIDROID_MESSAGE_H
 #define DEVIDROID_MESSAGE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
 #include <string>
-#include <queue>
 
 enum MASSAGER {
     MESSAGE,
@@ -18,24 +22,114 @@ enum MASSAGER {
     PUBLISHER
 };
 
+constexpr const int MASSAGER_COUNT = PUBLISHER + 1;
+
+// text up to this long (with its terminator) lives inside the queue slot, longer spills to the heap
+constexpr const size_t MESSAGE_INLINE = 240;
+
+// what setMessage does when the queue is full
+enum MessageOverflow {
+    DROP_OLDEST,
+    DROP_NEWEST,
+    BLOCK_PRODUCER
+};
+
 struct Messaging {
     MASSAGER massager = MESSAGE;
     std::string message;
 };
 
+// bounded multi-producer ring, popped by the ui thread
 class Message {
 public:
+    static constexpr size_t CAPACITY = 1024;
+
     static Message& instance();
 
     Messaging getMessage();
 
-    void setMessage(const std::string &message, MASSAGER massager);
+    // consumer side: pack up to 'max' messages into 'buffer' as records of
+    // int32 massager, int32 length, utf-8 bytes (native byte order, no padding);
+    // returns how many were written, a message that does not fit waits for the next call
+    size_t drainMessages(char *buffer, size_t capacity, size_t max);
+
+    // consumer side: park until something is queued or 'timeoutMs' passes (< 0 waits for ever),
+    // false on timeout; producers only pay for the wakeup while the consumer is parked
+    bool waitMessages(int timeoutMs);
+
+    // thread safe, false if the policy dropped this message
+    bool setMessage(const std::string &message, MASSAGER massager);
+
+    bool setMessage(const char *message, MASSAGER massager);
+
+    bool setMessage(const char *data, size_t length, MASSAGER massager);
+
+    // printf straight into the queue slot, no temporary string
+    bool formatMessage(MASSAGER massager, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    void setOverflow(MessageOverflow overflow);
+
+    uint64_t dropped(MASSAGER massager) const;
+
+    size_t size() const;
+
+    // 'producers' threads against one consumer, checks per producer order and counts drops
+    static void Benchmark(int producers = 8, int count = 100000, MessageOverflow overflow = DROP_OLDEST);
+
+    // latency from setMessage to a parked waitMessages returning, and cpu burnt while idle
+    static void WakeBenchmark(int rounds = 1000);
+
+    // ns per message and heap allocations of a concatenated std::string against formatMessage
+    static void PayloadBenchmark(int count = 1000000);
 
 private:
-    Message() {};
+    Message();
 
     ~Message() {};
-    static std::queue <Messaging> m_msgQue;
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        MASSAGER massager;
+        size_t length;
+        char text[MESSAGE_INLINE];
+        // only for text too long to inline, keeps its capacity across laps of the ring
+        std::string spill;
+
+        const char *data() const
+        {
+            return length < MESSAGE_INLINE ? text : spill.c_str();
+        }
+    };
+
+    // producer side: a slot owned by the caller until commit, nullptr if the policy dropped it
+    Slot *reserve(MASSAGER massager, size_t &pos);
+
+    void commit(Slot *slot, size_t pos);
+
+    // consumer side: the oldest published slot, owned by the caller until release
+    Slot *take(size_t &pos);
+
+    void release(Slot *slot, size_t pos);
+
+    bool readable() const;
+
+    void wake();
+
+    Slot m_slots[CAPACITY];
+    // producers and the consumer on separate cache lines
+    char m_pad0[64];
+    std::atomic<size_t> m_head;
+    char m_pad1[64];
+    std::atomic<size_t> m_tail;
+    char m_pad2[64];
+    std::atomic<int> m_overflow;
+    std::atomic<bool> m_sleeping;
+    std::mutex m_waitLock;
+    std::condition_variable m_wakeup;
+    // taken by drainMessages without room left, owned by the consumer
+    Messaging m_carry;
+    bool m_carried = false;
+    std::atomic<uint64_t> m_dropped[MASSAGER_COUNT];
 };
 
 
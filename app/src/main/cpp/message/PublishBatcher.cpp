@@ -0,0 +1,256 @@
+#ifndef LOG_TAG
+#define LOG_TAG "PublishBatcher"
+#endif
+
+#include "PublishBatcher.h"
+#include "PublisherPool.h"
+#include "Message.h"
+#include <cstdio>
+#include <vector>
+#include <Utils/logging.h>
+
+constexpr int BatchStats::BUCKETS;
+constexpr size_t PublishBatcher::MAX_BYTES;
+constexpr int PublishBatcher::DEADLINE_MS;
+
+namespace {
+    constexpr int BENCHMARK_DEADLINE_MS = 5;
+}
+
+PublishBatcher& PublishBatcher::instance()
+{
+    static PublishBatcher batcher;
+    return batcher;
+}
+
+PublishBatcher::PublishBatcher()
+{
+    // built first so it is destroyed after us: the last batches are sent on the way out
+    PublisherPool::instance();
+}
+
+PublishBatcher::~PublishBatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void PublishBatcher::Start()
+{
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&PublishBatcher::Run, this);
+    }
+}
+
+void PublishBatcher::Configure(size_t maxBytes, int deadlineMs)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_maxBytes = maxBytes > 0 && maxBytes < MAX_BYTES ? maxBytes : MAX_BYTES;
+    m_deadlineMs = deadlineMs > 0 ? deadlineMs : 0;
+    if (m_deadlineMs == 0) {
+        for (auto &batch : m_batches) {
+            Send(batch.second);
+        }
+    }
+    m_wake.notify_all();
+}
+
+void PublishBatcher::SetMode(const std::string &topic, BatchMode mode)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (mode == BATCH_COALESCE) {
+        m_coalesce.insert(topic);
+    } else {
+        m_coalesce.erase(topic);
+    }
+}
+
+bool PublishBatcher::Send(Batch &batch)
+{
+    if (batch.count == 0) {
+        return true;
+    }
+    bool queued = PublisherPool::instance().Publish(batch.addr, batch.port, batch.topic, batch.payload);
+    auto latency = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - batch.first).count());
+    int bucket = 0;
+    while (bucket < BatchStats::BUCKETS - 1 && (batch.count >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    m_stats.batches++;
+    m_stats.sizes[bucket]++;
+    m_stats.latencyTotalUs += latency;
+    if (latency > m_stats.latencyMaxUs) {
+        m_stats.latencyMaxUs = latency;
+    }
+    batch.count = 0;
+    batch.payload.clear();
+    return queued;
+}
+
+bool PublishBatcher::Publish(const std::string &addr, int port, const std::string &topic, const std::string &payload)
+{
+    std::string key = addr + ":" + std::to_string(port) + "/" + topic;
+    std::lock_guard<std::mutex> lock(m_lock);
+    Start();
+    Batch &batch = m_batches[key];
+    bool coalesce = m_coalesce.count(topic) != 0;
+    bool queued = true;
+    m_stats.messages++;
+    // a payload that would overflow the batch, or could not be told apart inside it, closes it first
+    if (batch.count > 0 && !coalesce && (batch.payload.size() + 1 + payload.size() > m_maxBytes
+                                         || payload.find('\n') != std::string::npos)) {
+        queued = Send(batch);
+    }
+    if (batch.count == 0) {
+        batch.addr = addr;
+        batch.port = port;
+        batch.topic = topic;
+        batch.first = Clock::now();
+        batch.deadline = batch.first + std::chrono::milliseconds(m_deadlineMs);
+        m_wake.notify_one();
+    }
+    if (coalesce) {
+        if (batch.count > 0) {
+            m_stats.coalesced++;
+        }
+        batch.payload.assign(payload);
+    } else {
+        if (batch.count > 0) {
+            batch.payload.push_back('\n');
+        }
+        batch.payload.append(payload);
+    }
+    batch.count++;
+    if (m_deadlineMs == 0 || batch.payload.size() >= m_maxBytes || (!coalesce && payload.find('\n') != std::string::npos)) {
+        queued = Send(batch) && queued;
+    }
+    return queued;
+}
+
+void PublishBatcher::Run()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stop) {
+        bool open = false;
+        Clock::time_point earliest = Clock::time_point::max();
+        for (auto &batch : m_batches) {
+            if (batch.second.count > 0) {
+                open = true;
+                if (batch.second.deadline < earliest) {
+                    earliest = batch.second.deadline;
+                }
+            }
+        }
+        if (!open) {
+            m_wake.wait(lock);
+            continue;
+        }
+        if (Clock::now() < earliest) {
+            m_wake.wait_until(lock, earliest);
+            continue;
+        }
+        Clock::time_point now = Clock::now();
+        for (auto &batch : m_batches) {
+            if (batch.second.count > 0 && batch.second.deadline <= now) {
+                Send(batch.second);
+            }
+        }
+    }
+    for (auto &batch : m_batches) {
+        Send(batch.second);
+    }
+}
+
+bool PublishBatcher::Flush(int timeoutMs)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto &batch : m_batches) {
+            Send(batch.second);
+        }
+    }
+    return PublisherPool::instance().Flush(timeoutMs);
+}
+
+BatchStats PublishBatcher::Stats()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+std::string PublishBatcher::StatsText()
+{
+    BatchStats stats = Stats();
+    char text[512];
+    int length = snprintf(text, sizeof(text),
+                          "%llu messages in %llu batches (%llu coalesced), flush latency avg %.1f us max %llu us, sizes",
+                          (unsigned long long) stats.messages, (unsigned long long) stats.batches,
+                          (unsigned long long) stats.coalesced,
+                          stats.batches > 0 ? static_cast<double>(stats.latencyTotalUs) / stats.batches : 0.0,
+                          (unsigned long long) stats.latencyMaxUs);
+    for (int i = 0; i < BatchStats::BUCKETS && length > 0 && static_cast<size_t>(length) < sizeof(text); i++) {
+        length += snprintf(text + length, sizeof(text) - length, " %d%s:%llu", 1 << i,
+                           i == BatchStats::BUCKETS - 1 ? "+" : "", (unsigned long long) stats.sizes[i]);
+    }
+    return text;
+}
+
+void PublishBatcher::Benchmark(const std::string &addr, int port, int count, int topics)
+{
+    if (addr.empty() || port <= 0 || count <= 0 || topics <= 0) {
+        LOGE("batch benchmark needs a broker");
+        return;
+    }
+    PublisherPool &pool = PublisherPool::instance();
+    PublishBatcher &batcher = instance();
+    size_t maxBytes;
+    int deadlineMs;
+    {
+        std::lock_guard<std::mutex> lock(batcher.m_lock);
+        maxBytes = batcher.m_maxBytes;
+        deadlineMs = batcher.m_deadlineMs;
+    }
+    // batching is off by default, the batched passes turn it on for themselves
+    batcher.Configure(MAX_BYTES, BENCHMARK_DEADLINE_MS);
+    std::vector<std::string> names;
+    for (int i = 0; i < topics; i++) {
+        names.push_back("benchmark/" + std::to_string(i));
+    }
+    const char *passes[] = {"unbatched", "packed", "coalesced"};
+    for (int pass = 0; pass < 3; pass++) {
+        for (const auto &name : names) {
+            batcher.SetMode(name, pass == 2 ? BATCH_COALESCE : BATCH_PACK);
+        }
+        PublisherStats before = pool.Stats();
+        auto start = Clock::now();
+        char payload[64];
+        for (int i = 0; i < count; i++) {
+            snprintf(payload, sizeof(payload), "{\"seq\":%d,\"value\":%d}", i, i * 7);
+            if (pass == 0) {
+                pool.Publish(addr, port, names[i % topics], payload);
+            } else {
+                batcher.Publish(addr, port, names[i % topics], payload);
+            }
+        }
+        bool flushed = pass == 0 ? pool.Flush(30000) : batcher.Flush(30000);
+        double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        PublisherStats after = pool.Stats();
+        Message::instance().formatMessage(LOG_VIEW, "%s x%d over %d topics: %llu publishes, %llu dropped, %.2f us/msg%s",
+                                          passes[pass], count, topics,
+                                          (unsigned long long) (after.published - before.published),
+                                          (unsigned long long) (after.dropped - before.dropped),
+                                          elapsed / count, flushed ? "" : ", flush timed out");
+    }
+    for (const auto &name : names) {
+        batcher.SetMode(name, BATCH_PACK);
+    }
+    batcher.Configure(maxBytes, deadlineMs);
+    Message::instance().setMessage(batcher.StatsText(), LOG_VIEW);
+}
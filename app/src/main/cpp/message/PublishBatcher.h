@@ -0,0 +1,101 @@
+#ifndef DEVIDROID_PUBLISHBATCHER_H
+#define DEVIDROID_PUBLISHBATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+// what a topic's batch turns into when flushed
+enum BatchMode {
+    // every payload, joined by '\n' into one publish
+    BATCH_PACK,
+    // only the newest payload: state topics where a reader wants the current value
+    BATCH_COALESCE
+};
+
+struct BatchStats {
+    static constexpr int BUCKETS = 8;
+    uint64_t batches = 0;
+    uint64_t messages = 0;
+    // replaced by a newer value of a coalescing topic before they went out
+    uint64_t coalesced = 0;
+    // batches by message count: 1, 2-3, 4-7, ... 128 and up
+    uint64_t sizes[BUCKETS] = {};
+    // first message of a batch queued to the batch handed to the publisher pool
+    uint64_t latencyTotalUs = 0;
+    uint64_t latencyMaxUs = 0;
+};
+
+// per-topic batching in front of PublisherPool: a batch goes out when it reaches 'maxBytes'
+// or 'deadlineMs' after its first message, whichever comes first. off until Configure gives a
+// deadline, subscribers have to split a packed payload on '\n' back into its messages
+class PublishBatcher {
+public:
+    // a Scadup message carries at most this much payload, a bigger batch would be cut short
+    static constexpr size_t MAX_BYTES = 256;
+    static constexpr int DEADLINE_MS = 0;
+
+    static PublishBatcher& instance();
+
+    // thread safe; a deadline of 0 hands every message straight to the pool,
+    // 'maxBytes' is capped at MAX_BYTES
+    void Configure(size_t maxBytes, int deadlineMs);
+
+    void SetMode(const std::string &topic, BatchMode mode);
+
+    // queues 'payload' into its topic's batch, false if the pool refused a flushed batch
+    bool Publish(const std::string &addr, int port, const std::string &topic, const std::string &payload);
+
+    // sends every open batch now and waits for the pool to drain
+    bool Flush(int timeoutMs);
+
+    BatchStats Stats();
+
+    std::string StatsText();
+
+    // 'count' small messages over 'topics' topics straight into the pool against batched
+    static void Benchmark(const std::string &addr, int port, int count = 10000, int topics = 4);
+
+private:
+    PublishBatcher();
+
+    ~PublishBatcher();
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Batch {
+        std::string addr;
+        int port = 0;
+        std::string topic;
+        std::string payload;
+        size_t count = 0;
+        Clock::time_point first;
+        Clock::time_point deadline;
+    };
+
+    void Start();
+
+    void Run();
+
+    // hands 'batch' to the pool and empties it keeping its buffer; m_lock held, so batches
+    // of one topic reach the pool in order
+    bool Send(Batch &batch);
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::map<std::string, Batch> m_batches;
+    std::set<std::string> m_coalesce;
+    size_t m_maxBytes = MAX_BYTES;
+    int m_deadlineMs = DEADLINE_MS;
+    bool m_stop = false;
+    std::thread m_thread;
+    BatchStats m_stats;
+};
+
+#endif //DEVIDROID_PUBLISHBATCHER_H
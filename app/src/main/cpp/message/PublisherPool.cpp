@@ -0,0 +1,224 @@
+#ifndef LOG_TAG
+#define LOG_TAG "PublisherPool"
+#endif
+
+#include "PublisherPool.h"
+#include "Message.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <Scadup/Scadup.h>
+#include <Utils/logging.h>
+
+constexpr int PublisherPool::CONNECTIONS;
+constexpr size_t PublisherPool::QUEUE_CAPACITY;
+constexpr int PublisherPool::BACKOFF_MIN_MS;
+constexpr int PublisherPool::BACKOFF_MAX_MS;
+
+PublisherPool& PublisherPool::instance()
+{
+    static PublisherPool pool;
+    return pool;
+}
+
+PublisherPool::~PublisherPool()
+{
+    Shutdown();
+}
+
+std::shared_ptr<PublisherPool::Connection> PublisherPool::Route(const std::string &addr, int port,
+                                                                const std::string &topic)
+{
+    std::string key = addr + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto &connections = m_endpoints[key];
+    if (connections.empty()) {
+        for (int i = 0; i < CONNECTIONS; i++) {
+            std::shared_ptr<Connection> connection(new Connection());
+            connection->addr = addr;
+            connection->port = port;
+            connection->thread = std::thread(&PublisherPool::Run, this, connection.get());
+            connections.push_back(std::move(connection));
+        }
+        LOGI("publisher pool: %d connections to %s", CONNECTIONS, key.c_str());
+    }
+    return connections[std::hash<std::string>()(topic) % connections.size()];
+}
+
+bool PublisherPool::Publish(const std::string &addr, int port, const std::string &topic, const std::string &payload)
+{
+    if (addr.empty() || port <= 0) {
+        return false;
+    }
+    std::shared_ptr<Connection> connection = Route(addr, port, topic);
+    {
+        std::lock_guard<std::mutex> lock(connection->lock);
+        if (connection->stop || connection->queue.size() >= QUEUE_CAPACITY) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        connection->queue.push_back(Publication{topic, payload, 0});
+    }
+    connection->work.notify_one();
+    return true;
+}
+
+void PublisherPool::Run(Connection *connection)
+{
+    std::unique_ptr<Scadup> broker;
+    std::deque<Publication> batch;
+    int backoff = BACKOFF_MIN_MS;
+    bool reported = false;
+    std::unique_lock<std::mutex> lock(connection->lock);
+    while (true) {
+        connection->work.wait(lock, [connection] { return connection->stop || !connection->queue.empty(); });
+        if (connection->stop) {
+            break;
+        }
+        // take the whole queue, producers go on filling a fresh one while it is written out
+        batch.swap(connection->queue);
+        connection->busy = true;
+        lock.unlock();
+        while (!batch.empty()) {
+            Publication &publication = batch.front();
+            if (!broker) {
+                broker.reset(new Scadup());
+                if (broker->Initialize(connection->addr.c_str(), static_cast<unsigned short>(connection->port)) < 0) {
+                    broker.reset();
+                    m_reconnects.fetch_add(1, std::memory_order_relaxed);
+                    if (!reported) {
+                        reported = true;
+                        Message::instance().setMessage("Message Publisher failed!", TOAST);
+                    }
+                    LOGE("connect %s:%d fail, retry in %d ms", connection->addr.c_str(), connection->port, backoff);
+                    lock.lock();
+                    bool stop = connection->work.wait_for(lock, std::chrono::milliseconds(backoff),
+                                                          [connection] { return connection->stop; });
+                    lock.unlock();
+                    backoff = std::min(backoff * 2, BACKOFF_MAX_MS);
+                    if (stop) {
+                        break;
+                    }
+                    continue;
+                }
+            }
+            if (broker->Publisher(publication.topic, publication.payload) < 0) {
+                // a dead connection only shows on write: reconnect and give the message one more try
+                broker.reset();
+                if (++publication.attempts < 2) {
+                    continue;
+                }
+                m_failed.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                m_published.fetch_add(1, std::memory_order_relaxed);
+                backoff = BACKOFF_MIN_MS;
+                reported = false;
+            }
+            batch.pop_front();
+        }
+        lock.lock();
+        m_dropped.fetch_add(batch.size(), std::memory_order_relaxed);
+        batch.clear();
+        connection->busy = false;
+        if (connection->queue.empty()) {
+            connection->idle.notify_all();
+        }
+    }
+    m_dropped.fetch_add(connection->queue.size(), std::memory_order_relaxed);
+    connection->queue.clear();
+    connection->busy = false;
+    connection->idle.notify_all();
+}
+
+bool PublisherPool::Flush(int timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    // wait outside m_lock so publishers are not held up; the copies keep the connections
+    // alive should Shutdown drop them meanwhile, its stop flag ends the wait
+    std::vector<std::shared_ptr<Connection>> connections;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto &endpoint : m_endpoints) {
+            connections.insert(connections.end(), endpoint.second.begin(), endpoint.second.end());
+        }
+    }
+    for (auto &connection : connections) {
+        std::unique_lock<std::mutex> wait(connection->lock);
+        if (!connection->idle.wait_until(wait, deadline, [&connection] {
+            return connection->stop || (connection->queue.empty() && !connection->busy);
+        })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PublisherPool::Shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto &endpoint : m_endpoints) {
+        for (auto &connection : endpoint.second) {
+            {
+                std::lock_guard<std::mutex> stop(connection->lock);
+                connection->stop = true;
+            }
+            connection->work.notify_all();
+        }
+    }
+    for (auto &endpoint : m_endpoints) {
+        for (auto &connection : endpoint.second) {
+            if (connection->thread.joinable()) {
+                connection->thread.join();
+            }
+        }
+    }
+    m_endpoints.clear();
+}
+
+PublisherStats PublisherPool::Stats() const
+{
+    PublisherStats stats;
+    stats.published = m_published.load(std::memory_order_relaxed);
+    stats.failed = m_failed.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    stats.reconnects = m_reconnects.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void PublisherPool::Benchmark(const std::string &addr, int port, int count)
+{
+    if (addr.empty() || port <= 0 || count <= 0) {
+        LOGE("publisher benchmark needs a broker");
+        return;
+    }
+    const std::string topic = "benchmark";
+    const std::string payload = "0123456789abcdef0123456789abcdef";
+    // what CPP_FUNC_CALL(Publish) used to do for every message
+    auto start = std::chrono::steady_clock::now();
+    int sent = 0;
+    for (int i = 0; i < count; i++) {
+        Scadup scadup;
+        scadup.Initialize(addr.c_str(), static_cast<unsigned short>(port));
+        if (scadup.Publisher(topic, payload) >= 0) {
+            sent++;
+        }
+    }
+    double connecting = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    PublisherPool &pool = instance();
+    PublisherStats before = pool.Stats();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        pool.Publish(addr, port, topic, payload);
+    }
+    double queued = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    bool flushed = pool.Flush(30000);
+    double pooled = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    PublisherStats after = pool.Stats();
+    Message::instance().formatMessage(LOG_VIEW,
+                                      "publish x%d: connect per message %.1f us/msg (%d sent), pool %.1f us/msg "
+                                      "(%.2f us to queue, %llu sent, %llu failed%s)",
+                                      count, connecting / count, sent, pooled / count, queued / count,
+                                      (unsigned long long) (after.published - before.published),
+                                      (unsigned long long) (after.failed - before.failed),
+                                      flushed ? "" : ", flush timed out");
+}
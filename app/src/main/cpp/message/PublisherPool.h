@@ -0,0 +1,87 @@
+#ifndef DEVIDROID_PUBLISHERPOOL_H
+#define DEVIDROID_PUBLISHERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct PublisherStats {
+    uint64_t published = 0;
+    // given up after a reconnect did not help either
+    uint64_t failed = 0;
+    // refused by a full queue or left behind by Shutdown
+    uint64_t dropped = 0;
+    uint64_t reconnects = 0;
+};
+
+// warm Scadup publisher connections per broker (addr, port): Publish only queues, a thread per
+// connection writes its queue back to back and reconnects with exponential backoff;
+// a topic always takes the same connection so its messages stay in order
+class PublisherPool {
+public:
+    static constexpr int CONNECTIONS = 2;
+    static constexpr size_t QUEUE_CAPACITY = 4096;
+    static constexpr int BACKOFF_MIN_MS = 50;
+    static constexpr int BACKOFF_MAX_MS = 5000;
+
+    static PublisherPool& instance();
+
+    // thread safe and non-blocking, false if the connection's queue is full and the message dropped
+    bool Publish(const std::string &addr, int port, const std::string &topic, const std::string &payload);
+
+    // waits until everything queued so far is published or given up, false on timeout
+    bool Flush(int timeoutMs);
+
+    // closes every connection, what is still queued is dropped
+    void Shutdown();
+
+    PublisherStats Stats() const;
+
+    // 'count' publishes to the broker as connect-per-message against the pool
+    static void Benchmark(const std::string &addr, int port, int count = 1000);
+
+private:
+    PublisherPool() = default;
+
+    ~PublisherPool();
+
+    struct Publication {
+        std::string topic;
+        std::string payload;
+        int attempts;
+    };
+
+    struct Connection {
+        std::string addr;
+        int port;
+        std::mutex lock;
+        std::condition_variable work;
+        std::condition_variable idle;
+        std::deque<Publication> queue;
+        bool busy = false;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    std::shared_ptr<Connection> Route(const std::string &addr, int port, const std::string &topic);
+
+    void Run(Connection *connection);
+
+    std::mutex m_lock;
+    // shared so Publish and Flush keep a connection alive after a concurrent Shutdown drops it
+    std::map<std::string, std::vector<std::shared_ptr<Connection>>> m_endpoints;
+    std::atomic<uint64_t> m_published{0};
+    std::atomic<uint64_t> m_failed{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_reconnects{0};
+};
+
+#endif //DEVIDROID_PUBLISHERPOOL_H
@@ -0,0 +1,449 @@
+#include "FecCodec.h"
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <random>
+
+#ifndef LOG_TAG
+#define LOG_TAG "FecCodec"
+#endif
+
+#include <Utils/logging.h>
+
+namespace {
+    // GF(2^8) with the reed-solomon polynomial x^8 + x^4 + x^3 + x^2 + 1
+    uint8_t g_exp[512];
+    uint8_t g_log[256];
+    uint8_t g_mul[256][256];
+
+    void InitTables()
+    {
+        static std::once_flag once;
+        std::call_once(once, []() {
+            unsigned int x = 1;
+            for (int i = 0; i < 255; i++) {
+                g_exp[i] = static_cast<uint8_t>(x);
+                g_log[x] = static_cast<uint8_t>(i);
+                x <<= 1;
+                if (x & 0x100) {
+                    x ^= 0x11d;
+                }
+            }
+            for (int i = 255; i < 512; i++) {
+                g_exp[i] = g_exp[i - 255];
+            }
+            for (int a = 1; a < 256; a++) {
+                for (int b = 1; b < 256; b++) {
+                    g_mul[a][b] = g_exp[g_log[a] + g_log[b]];
+                }
+            }
+        });
+    }
+
+    inline uint8_t Inverse(uint8_t a)
+    {
+        return g_exp[255 - g_log[a]];
+    }
+
+    // row 'parity' of the cauchy matrix, 1 / (x ^ y) with x >= 192 and y < 128 never zero
+    inline uint8_t Coefficient(unsigned int parity, unsigned int data)
+    {
+        return Inverse(static_cast<uint8_t>((255 - parity) ^ data));
+    }
+
+    // dst += c * src
+    void MulAdd(char *dst, const char *src, uint8_t c, size_t length)
+    {
+        auto *d = reinterpret_cast<uint8_t *>(dst);
+        auto *s = reinterpret_cast<const uint8_t *>(src);
+        if (c == 0) {
+            return;
+        }
+        if (c == 1) {
+            for (size_t i = 0; i < length; i++) {
+                d[i] ^= s[i];
+            }
+            return;
+        }
+        const uint8_t *table = g_mul[c];
+        for (size_t i = 0; i < length; i++) {
+            d[i] ^= table[s[i]];
+        }
+    }
+
+    // gauss-jordan in place, the matrix is always invertible for distinct cauchy rows
+    bool Invert(std::vector<uint8_t> &matrix, unsigned int n)
+    {
+        std::vector<uint8_t> inverse(n * n, 0);
+        for (unsigned int i = 0; i < n; i++) {
+            inverse[i * n + i] = 1;
+        }
+        for (unsigned int col = 0; col < n; col++) {
+            unsigned int pivot = col;
+            while (pivot < n && matrix[pivot * n + col] == 0) {
+                pivot++;
+            }
+            if (pivot == n) {
+                return false;
+            }
+            if (pivot != col) {
+                for (unsigned int k = 0; k < n; k++) {
+                    std::swap(matrix[pivot * n + k], matrix[col * n + k]);
+                    std::swap(inverse[pivot * n + k], inverse[col * n + k]);
+                }
+            }
+            uint8_t scale = Inverse(matrix[col * n + col]);
+            for (unsigned int k = 0; k < n; k++) {
+                matrix[col * n + k] = g_mul[scale][matrix[col * n + k]];
+                inverse[col * n + k] = g_mul[scale][inverse[col * n + k]];
+            }
+            for (unsigned int row = 0; row < n; row++) {
+                uint8_t factor = matrix[row * n + col];
+                if (row == col || factor == 0) {
+                    continue;
+                }
+                for (unsigned int k = 0; k < n; k++) {
+                    matrix[row * n + k] ^= g_mul[factor][matrix[col * n + k]];
+                    inverse[row * n + k] ^= g_mul[factor][inverse[col * n + k]];
+                }
+            }
+        }
+        matrix.swap(inverse);
+        return true;
+    }
+
+    inline uint32_t GroupOf(const char *data)
+    {
+        auto *p = reinterpret_cast<const uint8_t *>(data);
+        return (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+    }
+
+    // signed distance of 24 bit group numbers
+    inline int32_t GroupDiff(uint32_t a, uint32_t b)
+    {
+        return static_cast<int32_t>((a - b) << 8) >> 8;
+    }
+
+    inline size_t ShardLength(const char *shard)
+    {
+        auto *p = reinterpret_cast<const uint8_t *>(shard);
+        return (size_t) p[0] << 8 | p[1];
+    }
+}
+
+FecEncoder::FecEncoder(unsigned int data, unsigned int parity, FECHOOK output, void *user) :
+        m_data(data == 0 ? 1 : (data > FEC_MAX_DATA ? FEC_MAX_DATA : data)),
+        m_parity(parity > FEC_MAX_PARITY ? FEC_MAX_PARITY : parity),
+        m_output(output),
+        m_user(user),
+        m_shards(m_data)
+{
+    InitTables();
+}
+
+void FecEncoder::Emit(const char *shard, size_t length, unsigned int index, unsigned int count)
+{
+    m_packet.resize(FEC_HEADER + length);
+    auto *p = reinterpret_cast<uint8_t *>(m_packet.data());
+    p[0] = static_cast<uint8_t>(m_group >> 16);
+    p[1] = static_cast<uint8_t>(m_group >> 8);
+    p[2] = static_cast<uint8_t>(m_group);
+    p[3] = static_cast<uint8_t>(index);
+    p[4] = static_cast<uint8_t>(count);
+    p[5] = static_cast<uint8_t>(m_parity);
+    memcpy(p + FEC_HEADER, shard, length);
+    m_output(m_packet.data(), m_packet.size(), m_user);
+}
+
+int FecEncoder::Encode(const char *data, size_t size)
+{
+    if (size > 0xffff) {
+        return -1;
+    }
+    std::vector<char> &shard = m_shards[m_count];
+    shard.resize(2 + size);
+    shard[0] = static_cast<char>(size >> 8);
+    shard[1] = static_cast<char>(size);
+    memcpy(shard.data() + 2, data, size);
+    Emit(shard.data(), shard.size(), m_count, m_data);
+    if (shard.size() > m_length) {
+        m_length = shard.size();
+    }
+    if (++m_count == m_data) {
+        Flush();
+    }
+    return 0;
+}
+
+int FecEncoder::Flush()
+{
+    if (m_count == 0) {
+        return 0;
+    }
+    // shorter shards count as zero padded up to the longest one
+    for (unsigned int j = 0; j < m_parity; j++) {
+        m_repair.assign(m_length, 0);
+        for (unsigned int i = 0; i < m_count; i++) {
+            MulAdd(m_repair.data(), m_shards[i].data(), Coefficient(j, i), m_shards[i].size());
+        }
+        Emit(m_repair.data(), m_length, FEC_MAX_DATA + j, m_count);
+    }
+    m_group = (m_group + 1) & 0xffffff;
+    m_count = 0;
+    m_length = 0;
+    return static_cast<int>(m_parity);
+}
+
+unsigned int FecEncoder::Data() const
+{
+    return m_data;
+}
+
+unsigned int FecEncoder::Parity() const
+{
+    return m_parity;
+}
+
+FecDecoder::FecDecoder(FECHOOK hook, void *user, unsigned int window) :
+        m_hook(hook),
+        m_user(user),
+        m_window(window == 0 ? 1 : window)
+{
+    InitTables();
+}
+
+int FecDecoder::Input(const char *data, size_t size)
+{
+    if (size < FEC_OVERHEAD) {
+        return -1;
+    }
+    auto *p = reinterpret_cast<const uint8_t *>(data);
+    uint32_t id = GroupOf(data);
+    unsigned int index = p[3];
+    unsigned int count = p[4];
+    unsigned int parity = p[5];
+    const char *shard = data + FEC_HEADER;
+    size_t length = size - FEC_HEADER;
+    bool isData = index < FEC_MAX_DATA;
+    if (isData ? (index >= count || ShardLength(shard) > length - 2)
+               : (index - FEC_MAX_DATA >= parity || parity > FEC_MAX_PARITY
+                  || count == 0 || count > FEC_MAX_DATA)) {
+        return -2;
+    }
+
+    if (m_groups.empty() || GroupDiff(id, m_latest) > 0) {
+        m_latest = id;
+    }
+    if (GroupDiff(m_latest, id) >= (int32_t) m_window) {
+        // too late to help any repair, still worth passing on
+        if (isData) {
+            m_received++;
+            m_hook(shard + 2, ShardLength(shard), m_user);
+            return 1;
+        }
+        return 0;
+    }
+    for (auto it = m_groups.begin(); it != m_groups.end();) {
+        if (GroupDiff(m_latest, it->first) >= (int32_t) m_window) {
+            it = m_groups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    Group &group = m_groups[id];
+    if (group.have.empty()) {
+        group.have.resize(FEC_MAX_DATA + FEC_MAX_PARITY, false);
+        group.shards.resize(FEC_MAX_DATA + FEC_MAX_PARITY);
+    }
+    if (group.have[index]) {
+        return 0;
+    }
+    group.have[index] = true;
+    group.present++;
+    int delivered = 0;
+    if (!group.done) {
+        group.shards[index].assign(shard, shard + length);
+    }
+    if (isData) {
+        group.delivered++;
+        m_received++;
+        m_hook(shard + 2, ShardLength(shard), m_user);
+        delivered++;
+    } else {
+        group.count = static_cast<int>(count);
+        group.length = length;
+    }
+    if (!group.done && group.count >= 0) {
+        if (group.delivered < (unsigned int) group.count && group.present >= (unsigned int) group.count) {
+            delivered += Recover(group);
+        }
+        if (group.delivered >= (unsigned int) group.count) {
+            group.done = true;
+            group.shards.clear();
+            group.shards.shrink_to_fit();
+        }
+    }
+    return delivered;
+}
+
+int FecDecoder::Recover(Group &group)
+{
+    const unsigned int n = static_cast<unsigned int>(group.count);
+    // n rows: every data shard we hold, then parity rows for the gaps
+    std::vector<unsigned int> rows;
+    std::vector<unsigned int> missing;
+    for (unsigned int i = 0; i < n; i++) {
+        if (group.have[i]) {
+            rows.push_back(i);
+        } else {
+            missing.push_back(i);
+        }
+    }
+    for (unsigned int j = 0; j < FEC_MAX_PARITY && rows.size() < n; j++) {
+        if (group.have[FEC_MAX_DATA + j]) {
+            rows.push_back(FEC_MAX_DATA + j);
+        }
+    }
+    if (rows.size() < n) {
+        return 0;
+    }
+    std::vector<uint8_t> matrix(n * n, 0);
+    for (unsigned int r = 0; r < n; r++) {
+        if (rows[r] < FEC_MAX_DATA) {
+            matrix[r * n + rows[r]] = 1;
+        } else {
+            for (unsigned int c = 0; c < n; c++) {
+                matrix[r * n + c] = Coefficient(rows[r] - FEC_MAX_DATA, c);
+            }
+        }
+    }
+    if (!Invert(matrix, n)) {
+        LOGE("fec matrix of %u rows is singular.", n);
+        return 0;
+    }
+    int recovered = 0;
+    // rebuilt at the same offset as in a datagram, so the payload is 8 byte aligned
+    std::vector<char> buffer;
+    for (unsigned int i : missing) {
+        buffer.assign(FEC_HEADER + group.length, 0);
+        char *shard = buffer.data() + FEC_HEADER;
+        for (unsigned int r = 0; r < n; r++) {
+            const std::vector<char> &row = group.shards[rows[r]];
+            MulAdd(shard, row.data(), matrix[i * n + r], std::min(row.size(), group.length));
+        }
+        size_t length = ShardLength(shard);
+        if (length > group.length - 2) {
+            continue;
+        }
+        group.have[i] = true;
+        group.delivered++;
+        m_recovered++;
+        m_hook(shard + 2, length, m_user);
+        recovered++;
+    }
+    return recovered;
+}
+
+uint64_t FecDecoder::Received() const
+{
+    return m_received;
+}
+
+uint64_t FecDecoder::Recovered() const
+{
+    return m_recovered;
+}
+
+namespace {
+    struct BenchChannel {
+        std::mt19937 random;
+        double loss = 0;
+        FecDecoder *decoder = nullptr;
+        uint64_t sent = 0;
+        uint64_t bytes = 0;
+        uint64_t lostData = 0;
+        uint64_t delivered = 0;
+        uint64_t corrupt = 0;
+    };
+
+    void BenchDiscard(const char *, size_t size, void *user)
+    {
+        auto *channel = static_cast<BenchChannel *>(user);
+        channel->sent++;
+        channel->bytes += size;
+    }
+
+    void BenchLossy(const char *data, size_t size, void *user)
+    {
+        auto *channel = static_cast<BenchChannel *>(user);
+        if (std::uniform_real_distribution<double>(0, 100)(channel->random) < channel->loss) {
+            if (static_cast<uint8_t>(data[3]) < FEC_MAX_DATA) {
+                channel->lostData++;
+            }
+            return;
+        }
+        channel->decoder->Input(data, size);
+    }
+
+    void BenchDeliver(const char *data, size_t size, void *user)
+    {
+        auto *channel = static_cast<BenchChannel *>(user);
+        uint32_t seq;
+        memcpy(&seq, data, sizeof(seq));
+        for (size_t i = sizeof(seq); i < size; i++) {
+            if (static_cast<uint8_t>(data[i]) != static_cast<uint8_t>(seq + i)) {
+                channel->corrupt++;
+                break;
+            }
+        }
+        channel->delivered++;
+    }
+}
+
+void FecDecoder::Benchmark(unsigned int data, unsigned int parity, double loss, int packets, size_t size)
+{
+    std::vector<char> packet(size < sizeof(uint32_t) ? sizeof(uint32_t) : size);
+    auto fill = [&packet](uint32_t seq) {
+        memcpy(packet.data(), &seq, sizeof(seq));
+        for (size_t i = sizeof(seq); i < packet.size(); i++) {
+            packet[i] = static_cast<char>(seq + i);
+        }
+    };
+    double megabytes = (double) packets * packet.size() / (1 << 20);
+
+    // encode alone
+    BenchChannel encoded;
+    FecEncoder encoder(data, parity, BenchDiscard, &encoded);
+    std::clock_t start = std::clock();
+    for (int i = 0; i < packets; i++) {
+        fill(static_cast<uint32_t>(i));
+        encoder.Encode(packet.data(), packet.size());
+    }
+    encoder.Flush();
+    double encodeMs = (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+    // encode, lose and decode, decode cost is the difference
+    BenchChannel channel;
+    channel.random.seed(1);
+    channel.loss = loss;
+    FecDecoder decoder(BenchDeliver, &channel);
+    channel.decoder = &decoder;
+    FecEncoder lossy(data, parity, BenchLossy, &channel);
+    start = std::clock();
+    for (int i = 0; i < packets; i++) {
+        fill(static_cast<uint32_t>(i));
+        lossy.Encode(packet.data(), packet.size());
+    }
+    lossy.Flush();
+    double totalMs = (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    double decodeMs = totalMs > encodeMs ? totalMs - encodeMs : 0;
+
+    LOGI("fec %u+%u, %.1f%% loss: %llu lost, %llu recovered (%.1f%%), residual loss %.2f%%, %llu corrupt.",
+         data, parity, loss, (unsigned long long) channel.lostData,
+         (unsigned long long) decoder.Recovered(),
+         channel.lostData > 0 ? decoder.Recovered() * 100.0 / channel.lostData : 100.0,
+         (packets - (double) channel.delivered) * 100.0 / packets, (unsigned long long) channel.corrupt);
+    LOGI("fec %u+%u: %.2fx bytes on the wire, encode %.2fms/MB, decode %.2fms/MB.", data, parity,
+         encoded.bytes / (megabytes * (1 << 20)), encodeMs / megabytes, decodeMs / megabytes);
+}
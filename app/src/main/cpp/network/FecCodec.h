@@ -0,0 +1,89 @@
+#ifndef DEVIDROID_FECCODEC_H
+#define DEVIDROID_FECCODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// group(3, big endian) index(1) data(1) parity(1), then the coded shard: length(2) payload;
+// payload starts 8 bytes into the datagram, so headers behind it stay aligned
+constexpr const size_t FEC_HEADER = 6;
+constexpr const size_t FEC_OVERHEAD = FEC_HEADER + 2;
+constexpr const unsigned int FEC_MAX_DATA = 128;
+constexpr const unsigned int FEC_MAX_PARITY = 64;
+
+// one datagram in or out of the codec, only valid inside the hook
+typedef void(*FECHOOK)(const char *data, size_t size, void *user);
+
+// systematic reed-solomon over GF(256) with a cauchy matrix: data datagrams go out
+// right away with a small header, every 'data' of them are followed by 'parity' repair
+// datagrams, and any 'data' of the group are enough to rebuild the rest
+class FecEncoder {
+public:
+    FecEncoder(unsigned int data, unsigned int parity, FECHOOK output, void *user = nullptr);
+
+    int Encode(const char *data, size_t size);
+
+    // close the current group early, e.g. at the end of a message
+    int Flush();
+
+    unsigned int Data() const;
+
+    unsigned int Parity() const;
+
+private:
+    void Emit(const char *shard, size_t length, unsigned int index, unsigned int count);
+
+    const unsigned int m_data;
+    const unsigned int m_parity;
+    FECHOOK m_output;
+    void *m_user;
+    uint32_t m_group = 0;
+    unsigned int m_count = 0;
+    size_t m_length = 0;
+    std::vector<std::vector<char>> m_shards;
+    std::vector<char> m_repair;
+    std::vector<char> m_packet;
+};
+
+// passes data datagrams through and rebuilds lost ones once enough of their group arrived;
+// not thread safe, one decoder per sender
+class FecDecoder {
+public:
+    explicit FecDecoder(FECHOOK hook, void *user = nullptr, unsigned int window = 64);
+
+    // datagrams handed to the hook, <0 if malformed
+    int Input(const char *data, size_t size);
+
+    uint64_t Received() const;
+
+    uint64_t Recovered() const;
+
+    // loss and cpu cost of encode/decode over a random erasure channel
+    static void Benchmark(unsigned int data = 10, unsigned int parity = 3, double loss = 10,
+                          int packets = 100000, size_t size = 1024);
+
+private:
+    struct Group {
+        int count = -1;
+        unsigned int present = 0;
+        unsigned int delivered = 0;
+        bool done = false;
+        size_t length = 0;
+        std::vector<std::vector<char>> shards;
+        std::vector<bool> have;
+    };
+
+    int Recover(Group &group);
+
+    FECHOOK m_hook;
+    void *m_user;
+    const unsigned int m_window;
+    uint32_t m_latest = 0;
+    std::map<uint32_t, Group> m_groups;
+    uint64_t m_received = 0;
+    uint64_t m_recovered = 0;
+};
+
+#endif //DEVIDROID_FECCODEC_H
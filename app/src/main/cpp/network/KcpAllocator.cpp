@@ -0,0 +1,237 @@
+#include "KcpAllocator.h"
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include "kcp/ikcp.h"
+#include "KcpEmulator.h"
+
+#ifndef LOG_TAG
+#define LOG_TAG "KcpAllocator"
+#endif
+
+#include <Utils/logging.h>
+
+namespace {
+    // sizeof(IKCPSEG) + payload, a 1400 mtu segment fits in 2048
+    const size_t CLASS_SIZE[] = {128, 256, 512, 1024, 2048};
+    const int CLASSES = sizeof(CLASS_SIZE) / sizeof(CLASS_SIZE[0]);
+    const int OVERSIZE = CLASSES;
+    // blocks kept per class per thread before half of them go to the shared list
+    const int CACHE_LIMIT = 512;
+
+    // in front of every block, keeps the payload 16 bytes aligned
+    struct Block {
+        Block *next;
+        int cls;
+    };
+    const size_t HEADER = (sizeof(Block) + 15) & ~(size_t) 15;
+
+    std::atomic<Block *> g_shared[CLASSES];
+    std::atomic<bool> g_pooling(true);
+
+    std::atomic<uint64_t> g_allocs(0);
+    std::atomic<uint64_t> g_frees(0);
+    std::atomic<uint64_t> g_hits(0);
+    std::atomic<uint64_t> g_refills(0);
+    std::atomic<uint64_t> g_misses(0);
+    std::atomic<uint64_t> g_oversize(0);
+    std::atomic<int64_t> g_inuse(0);
+
+    // push only, the single consumer takes the whole list with exchange so there is no ABA
+    void PushShared(int cls, Block *head, Block *tail)
+    {
+        Block *top = g_shared[cls].load(std::memory_order_relaxed);
+        do {
+            tail->next = top;
+        } while (!g_shared[cls].compare_exchange_weak(top, head, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+    }
+
+    Block *TakeShared(int cls)
+    {
+        return g_shared[cls].exchange(nullptr, std::memory_order_acquire);
+    }
+
+    struct ThreadCache {
+        Block *list[CLASSES] = {};
+        int count[CLASSES] = {};
+
+        void Spill(int cls, int keep)
+        {
+            if (count[cls] <= keep) {
+                return;
+            }
+            Block *head = list[cls];
+            Block *tail = head;
+            for (int i = count[cls] - keep; i > 1; i--) {
+                tail = tail->next;
+            }
+            list[cls] = tail->next;
+            count[cls] = keep;
+            PushShared(cls, head, tail);
+        }
+
+        ~ThreadCache()
+        {
+            for (int cls = 0; cls < CLASSES; cls++) {
+                Spill(cls, 0);
+            }
+        }
+    };
+
+    thread_local ThreadCache t_cache;
+
+    int SizeClass(size_t size)
+    {
+        for (int cls = 0; cls < CLASSES; cls++) {
+            if (size <= CLASS_SIZE[cls]) {
+                return cls;
+            }
+        }
+        return OVERSIZE;
+    }
+
+    void *Payload(Block *block)
+    {
+        return reinterpret_cast<char *>(block) + HEADER;
+    }
+
+    Block *Header(void *ptr)
+    {
+        return reinterpret_cast<Block *>(static_cast<char *>(ptr) - HEADER);
+    }
+}
+
+void KcpAllocator::Install()
+{
+    static std::once_flag once;
+    std::call_once(once, []() { ikcp_allocator(KcpAllocator::Malloc, KcpAllocator::Free); });
+}
+
+void KcpAllocator::SetPooling(bool enable)
+{
+    g_pooling.store(enable, std::memory_order_relaxed);
+}
+
+void *KcpAllocator::Malloc(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    int cls = g_pooling.load(std::memory_order_relaxed) ? SizeClass(size) : OVERSIZE;
+    if (cls == OVERSIZE) {
+        g_oversize.fetch_add(1, std::memory_order_relaxed);
+        auto block = static_cast<Block *>(malloc(HEADER + size));
+        if (block == nullptr) {
+            return nullptr;
+        }
+        block->cls = OVERSIZE;
+        return Payload(block);
+    }
+    ThreadCache &cache = t_cache;
+    Block *block = cache.list[cls];
+    if (block == nullptr) {
+        block = TakeShared(cls);
+        if (block != nullptr) {
+            int count = 0;
+            for (Block *it = block; it != nullptr; it = it->next) {
+                count++;
+            }
+            cache.count[cls] = count;
+            g_refills.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        g_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (block != nullptr) {
+        cache.list[cls] = block->next;
+        cache.count[cls]--;
+    } else {
+        g_misses.fetch_add(1, std::memory_order_relaxed);
+        block = static_cast<Block *>(malloc(HEADER + CLASS_SIZE[cls]));
+        if (block == nullptr) {
+            return nullptr;
+        }
+    }
+    block->cls = cls;
+    g_inuse.fetch_add(1, std::memory_order_relaxed);
+    return Payload(block);
+}
+
+void KcpAllocator::Free(void *ptr)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    g_frees.fetch_add(1, std::memory_order_relaxed);
+    Block *block = Header(ptr);
+    int cls = block->cls;
+    if (cls == OVERSIZE) {
+        free(block);
+        return;
+    }
+    g_inuse.fetch_sub(1, std::memory_order_relaxed);
+    ThreadCache &cache = t_cache;
+    block->next = cache.list[cls];
+    cache.list[cls] = block;
+    if (++cache.count[cls] > CACHE_LIMIT) {
+        cache.Spill(cls, CACHE_LIMIT / 2);
+    }
+}
+
+KcpAllocStat KcpAllocator::Stat()
+{
+    KcpAllocStat stat{};
+    stat.allocs = g_allocs.load(std::memory_order_relaxed);
+    stat.frees = g_frees.load(std::memory_order_relaxed);
+    stat.hits = g_hits.load(std::memory_order_relaxed);
+    stat.refills = g_refills.load(std::memory_order_relaxed);
+    stat.misses = g_misses.load(std::memory_order_relaxed);
+    stat.oversize = g_oversize.load(std::memory_order_relaxed);
+    stat.inuse = g_inuse.load(std::memory_order_relaxed);
+    return stat;
+}
+
+void KcpAllocator::Trim()
+{
+    ThreadCache &cache = t_cache;
+    for (int cls = 0; cls < CLASSES; cls++) {
+        cache.Spill(cls, 0);
+        Block *block = TakeShared(cls);
+        while (block != nullptr) {
+            Block *next = block->next;
+            free(block);
+            block = next;
+        }
+    }
+}
+
+void KcpAllocator::Benchmark(int packets, int rounds)
+{
+    Install();
+    KcpConfig config = KcpConfig::Mode(2);
+    config.period = 1;
+    config.wnd = 1024;
+    config.size = 1024;
+    double cpu[2] = {};
+    for (int pooling = 0; pooling < 2; pooling++) {
+        SetPooling(pooling == 1);
+        KcpAllocStat before = Stat();
+        std::clock_t start = std::clock();
+        for (int i = 0; i < rounds; i++) {
+            KcpEmulator emulator;
+            emulator.KcpSimulate(config, i + 1, packets);
+        }
+        cpu[pooling] = (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+        KcpAllocStat after = Stat();
+        LOGI("kcp %s: %d x %d packets, %.0fms cpu, %llu allocs, %llu cached, %llu refills, %llu new.",
+             pooling ? "pool" : "malloc", rounds, packets, cpu[pooling],
+             (unsigned long long) (after.allocs - before.allocs),
+             (unsigned long long) (after.hits - before.hits),
+             (unsigned long long) (after.refills - before.refills),
+             (unsigned long long) (after.misses - before.misses));
+    }
+    SetPooling(true);
+    if (cpu[1] > 0) {
+        LOGI("kcp pool speedup: %.2fx.", cpu[0] / cpu[1]);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef DEVIDROID_KCPALLOCATOR_H
+#define DEVIDROID_KCPALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct KcpAllocStat {
+    uint64_t allocs;
+    uint64_t frees;
+    // served from a thread cache / refilled from the shared lists / new blocks from malloc
+    uint64_t hits;
+    uint64_t refills;
+    uint64_t misses;
+    // larger than the biggest class (kcp buffer, big acklist), passed through to malloc
+    uint64_t oversize;
+    // blocks currently handed out by the pool
+    int64_t inuse;
+};
+
+// size-class pool behind ikcp_allocator for segments and acklists.
+// freed blocks go to a per-thread cache first, overflow and exiting threads
+// hand them over to lock-free per-class lists that other threads refill from
+class KcpAllocator {
+public:
+    // register with ikcp_allocator; jniComm does it while loading, before any kcp object can exist,
+    // later calls are no-ops
+    static void Install();
+
+    // while off every request goes straight to malloc, blocks already pooled are still freed right
+    static void SetPooling(bool enable);
+
+    static void *Malloc(size_t size);
+
+    static void Free(void *ptr);
+
+    static KcpAllocStat Stat();
+
+    // release the calling thread's cache and the shared lists back to the system
+    static void Trim();
+
+    // emulator cpu time with system malloc against the pool
+    static void Benchmark(int packets = 20000, int rounds = 5);
+};
+
+#endif //DEVIDROID_KCPALLOCATOR_H
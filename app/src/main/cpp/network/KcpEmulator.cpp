@@ -1,35 +1,170 @@
-#include "KcpEmulator.h"
+#ifndef LOG_TAG
+#define LOG_TAG "KcpEmulator"
+#endif
 
-// 模拟网络
-KcpEmulator *vnet;
+#include "KcpEmulator.h"
+#include <Utils/logging.h>
+#include <cmath>
+#include <algorithm>
+#include <deque>
+#include <set>
 
 class iterator;
 
+// 端点：模拟网络和端点编号，作为 kcp的 user参数
+struct KcpEndpoint {
+    KcpEmulator *vnet;
+    int peer;
+};
+
 // lostrate: 往返一周丢包率的百分比，默认 10%
 // rttmin：rtt最小值，默认 60
 // rttmax：rtt最大值，默认 125
 KcpEmulator::KcpEmulator(int lostrate, int rttmin, int rttmax, int nmax) :
         r12(100), r21(100)
 {
+    simulate = false;
+    rng.seed((unsigned int) iclock64());
     current = iclock();
-    this->lostrate = lostrate / 2;    // 上面数据是往返丢包率，单程除以2
-    this->rttmin = rttmin / 2;
-    this->rttmax = rttmax / 2;
+    seq = 0;
+    wire = pushes = 0;
+    maxsn[0] = maxsn[1] = 0;
+    KcpImpairment impairment;
+    impairment.lostrate = lostrate / 2;    // 上面数据是往返丢包率，单程除以2
+    impairment.rttmin = rttmin / 2;
+    impairment.rttmax = rttmax / 2;
+    SetImpairment(impairment);
     this->nmax = nmax;
     tx1 = tx2 = 0;
 }
 
 KcpEmulator::~KcpEmulator()
 {
-    DelayTunnel::iterator it;
-    for (it = p12.begin(); it != p12.end(); it++) {
-        delete *it;
+    while (!p12.empty()) {
+        delete p12.top().pkt;
+        p12.pop();
+    }
+    while (!p21.empty()) {
+        delete p21.top().pkt;
+        p21.pop();
+    }
+}
+
+void KcpEmulator::SetVirtualClock(IUINT32 now)
+{
+    simulate = true;
+    current = now;
+}
+
+void KcpEmulator::Seed(unsigned int seed)
+{
+    rng.seed(seed);
+    r12 = Random(100);
+    r21 = Random(100);
+}
+
+void KcpEmulator::SetImpairment(const KcpImpairment &impairment)
+{
+    impair = impairment;
+    lostrate = impair.lostrate;
+    rttmin = impair.rttmin;
+    rttmax = impair.rttmax;
+    bad[0] = bad[1] = false;
+    busy[0] = busy[1] = 0;
+}
+
+IUINT32 KcpEmulator::Now() const
+{
+    return simulate ? current : iclock();
+}
+
+bool KcpEmulator::Chance(double percent)
+{
+    if (percent <= 0) return false;
+    return std::uniform_real_distribution<double>(0, 100)(rng) < percent;
+}
+
+bool KcpEmulator::Lost(int peer)
+{
+    if (impair.geGood2Bad <= 0) {
+        // 均匀丢包
+        return (peer == 0 ? r12 : r21).random(rng) < lostrate;
+    }
+    // Gilbert-Elliott 突发丢包：先转移状态，再按状态的丢包率丢包
+    if (bad[peer]) {
+        if (Chance(impair.geBad2Good)) bad[peer] = false;
+    } else {
+        if (Chance(impair.geGood2Bad)) bad[peer] = true;
+    }
+    return Chance(bad[peer] ? impair.geLossBad : impair.geLossGood);
+}
+
+IUINT32 KcpEmulator::Delay()
+{
+    int range = rttmax - rttmin;
+    if (range <= 0) return rttmin;
+    switch (impair.jitter) {
+        case JITTER_NORMAL: {
+            std::normal_distribution<double> normal(rttmin + range / 2.0, range / 6.0);
+            double delay = normal(rng);
+            return delay < rttmin ? rttmin : (IUINT32) delay;
+        }
+        case JITTER_PARETO: {
+            // alpha=2.5，平均值落在 rttmin/rttmax 中点，最长 10 倍 rttmax
+            const double alpha = 2.5;
+            double scale = range / 2.0 * (alpha - 1);
+            double u = std::uniform_real_distribution<double>(1e-9, 1)(rng);
+            double delay = rttmin + scale / pow(u, 1 / alpha) - scale;
+            return delay > rttmax * 10.0 ? rttmax * 10 : (IUINT32) delay;
+        }
+        default:
+            return rttmin + rng() % range;
     }
-    for (it = p21.begin(); it != p21.end(); it++) {
-        delete *it;
+}
+
+KcpConfig KcpConfig::Mode(int mode)
+{
+    KcpConfig config;
+    if (mode == 0) {
+        // 默认模式
+        config.nodelay = 0;
+        config.nc = 0;
+    } else if (mode == 1) {
+        // 普通模式，关闭流控等
+        config.nodelay = 0;
+        config.nc = 1;
+    } else {
+        // 启动快速模式
+        // nodelay-启用以后若干常规加速将启动
+        // interval为内部处理时钟，默认设置为 10ms
+        // resend为快速重传指标，原来设置为2之后又把 fastresend改成了 1，和 KcpTransport一样
+        // nc为是否禁用常规流控，这里禁止
+        config.nodelay = 2;
+        config.resend = 1;
+        config.nc = 1;
+        config.minrto = 10;
+    }
+    return config;
+}
+
+// kcp 包头：conv(4) cmd(1) frg(1) wnd(2) ts(4) sn(4) una(4) len(4)，小端
+void KcpEmulator::Account(int peer, const void *data, int size)
+{
+    const int overhead = 24;
+    const int push = 81;    // IKCP_CMD_PUSH
+    auto *ptr = (const unsigned char *) data;
+    wire += size;
+    while (size >= overhead) {
+        IUINT32 sn = ptr[12] | ptr[13] << 8 | ptr[14] << 16 | (IUINT32) ptr[15] << 24;
+        IUINT32 len = ptr[20] | ptr[21] << 8 | ptr[22] << 16 | (IUINT32) ptr[23] << 24;
+        if (ptr[4] == push) {
+            pushes++;
+            if (sn + 1 > maxsn[peer]) maxsn[peer] = sn + 1;
+        }
+        if ((IINT64) len > size - overhead) break;
+        ptr += overhead + len;
+        size -= overhead + (int) len;
     }
-    p12.clear();
-    p21.clear();
 }
 
 // 发送数据
@@ -38,44 +173,43 @@ void KcpEmulator::Sender(int peer, const void *data, int size)
 {
     if (peer == 0) {
         tx1++;
-        if (r12.random() < lostrate) return;
-        if ((int) p12.size() >= nmax) return;
     } else {
         tx2++;
-        if (r21.random() < lostrate) return;
-        if ((int) p21.size() >= nmax) return;
     }
-    auto *pkt = new DelayPacket(size, data);
-    current = iclock();
-    IUINT32 delay = rttmin;
-    if (rttmax > rttmin) delay += rand() % (rttmax - rttmin);
-    pkt->setts(current + delay);
-    if (peer == 0) {
-        p12.push_back(pkt);
-    } else {
-        p21.push_back(pkt);
+    Account(peer, data, size);
+    DelayTunnel &tunnel = peer == 0 ? p12 : p21;
+    if (Lost(peer)) return;
+    if ((int) tunnel.size() >= nmax) return;
+    current = Now();
+
+    // 带宽限制：包要等链路空闲再发出，排队太久就丢弃
+    double depart = current;
+    if (impair.bandwidth > 0) {
+        if (busy[peer] > depart) depart = busy[peer];
+        if (impair.queuems > 0 && depart - current > impair.queuems) return;
+        depart += size * 1000.0 / impair.bandwidth;
+        busy[peer] = depart;
+    }
+
+    int copies = Chance(impair.duplicate) ? 2 : 1;
+    for (int i = 0; i < copies; i++) {
+        IUINT32 delay = Delay();
+        if (Chance(impair.reorder)) delay += impair.reorderms;
+        auto *pkt = new DelayPacket(size, data);
+        pkt->setts(current + (IUINT32) (depart - current) + delay);
+        tunnel.push(TunnelEntry{pkt->ts(), seq++, pkt});
     }
 }
 
 int KcpEmulator::Receiver(int peer, void *data, int maxsize)
 {
-    DelayTunnel::iterator it;
-    if (peer == 0) {
-        it = p21.begin();
-        if (p21.size() == 0) return -1;
-    } else {
-        it = p12.begin();
-        if (p12.size() == 0) return -1;
-    }
-    DelayPacket *pkt = *it;
-    current = iclock();
-    if (current < pkt->ts()) return -2;
+    DelayTunnel &tunnel = peer == 0 ? p21 : p12;
+    if (tunnel.empty()) return -1;
+    DelayPacket *pkt = tunnel.top().pkt;
+    current = Now();
+    if ((IINT32) (current - pkt->ts()) < 0) return -2;
     if (maxsize < pkt->size()) return -3;
-    if (peer == 0) {
-        p21.erase(it);
-    } else {
-        p12.erase(it);
-    }
+    tunnel.pop();
     maxsize = pkt->size();
     memcpy(data, pkt->ptr(), maxsize);
     delete pkt;
@@ -85,87 +219,121 @@ int KcpEmulator::Receiver(int peer, void *data, int maxsize)
 // 模拟网络：模拟发送一个 udp包
 int udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 {
-    union {
-        int id;
-        void *ptr;
-    } parameter{};
-    parameter.ptr = user;
-    vnet->Sender(parameter.id, buf, len);
+    auto *endpoint = (KcpEndpoint *) user;
+    endpoint->vnet->Sender(endpoint->peer, buf, len);
     return 0;
 }
 
+// 下一个事件的时间：隧道里最早到达的包、ikcp_check、下一次发送
+IUINT32 KcpEmulator::NextEvent(ikcpcb *kcp1, ikcpcb *kcp2, IUINT32 slap) const
+{
+    IUINT32 next = slap;
+    IUINT32 check = ikcp_check(kcp1, current);
+    if ((IINT32) (check - next) < 0) next = check;
+    check = ikcp_check(kcp2, current);
+    if ((IINT32) (check - next) < 0) next = check;
+    if (!p12.empty() && (IINT32) (p12.top().ts - next) < 0) next = p12.top().ts;
+    if (!p21.empty() && (IINT32) (p21.top().ts - next) < 0) next = p21.top().ts;
+    if ((IINT32) (next - current) <= 0) next = current + 1;
+    return next;
+}
+
 // 测试用例
 void KcpEmulator::KcpRun(int mode)
 {
-    // 创建模拟网络：丢包率10%，Rtt 60ms~125ms
-    vnet = new KcpEmulator(10, 60, 125);
+    KcpStat stat = Run(mode, KcpConfig::Mode(mode), 1000, false);
+    if (stat.count <= 0) return;
+
+    const char *names[3] = {"default", "normal", "fast"};
+    printf("%s mode result (%dms):\n", names[mode], (int) stat.elapsed);
+    printf("avgrtt=%d maxrtt=%d tx=%d\n", (int) (stat.sumrtt / stat.count), (int) stat.maxrtt, (int) stat.tx);
+    printf("press enter to next ...\n");
+    char ch;
+    scanf("%c", &ch);
+}
+
+KcpStat KcpEmulator::KcpSimulate(int mode, unsigned int seed, int packets)
+{
+    Seed(seed);
+    SetVirtualClock(0);
+    return Run(mode, KcpConfig::Mode(mode), packets, true);
+}
+
+KcpStat KcpEmulator::KcpSimulate(const KcpConfig &config, unsigned int seed, int packets)
+{
+    Seed(seed);
+    SetVirtualClock(0);
+    return Run(-1, config, packets, true);
+}
 
+KcpStat KcpEmulator::Run(int mode, const KcpConfig &config, int packets, bool virtualClock)
+{
     // 创建两个端点的 kcp对象，第一个参数 conv是会话编号，同一个会话需要相同
     // 最后一个是 user参数，用来传递标识
-    ikcpcb *kcp1 = ikcp_create(0x11223344, (void *) 0);
-    ikcpcb *kcp2 = ikcp_create(0x11223344, (void *) 1);
+    KcpEndpoint endpoint1 = {this, 0};
+    KcpEndpoint endpoint2 = {this, 1};
+    ikcpcb *kcp1 = ikcp_create(0x11223344, &endpoint1);
+    ikcpcb *kcp2 = ikcp_create(0x11223344, &endpoint2);
 
     // 设置kcp的下层输出，这里为 udp_output，模拟udp网络输出函数
     kcp1->output = udp_output;
     kcp2->output = udp_output;
 
-    IUINT32 current = iclock();
-    IUINT32 slap = current + 20;
+    IUINT32 current = Now();
+    IUINT32 slap = current + config.period;
     IUINT32 index = 0;
     IUINT32 next = 0;
-    IINT64 sumrtt = 0;
-    int count = 0;
-    int maxrtt = 0;
+    KcpStat stat = {mode, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    std::vector<IUINT32> rtts;
+    tx1 = tx2 = 0;
+    wire = pushes = 0;
+    maxsn[0] = maxsn[1] = 0;
 
     // 配置窗口大小：平均延迟200ms，每20ms发送一个包，
-    // 而考虑到丢包重发，设置最大收发窗口为128
-    ikcp_wndsize(kcp1, RECVWND, RECVWND);
-    ikcp_wndsize(kcp2, RECVWND, RECVWND);
-
-    // 判断测试用例的模式
-    if (mode == 0) {
-        // 默认模式
-        ikcp_nodelay(kcp1, 0, 10, 0, 0);
-        ikcp_nodelay(kcp2, 0, 10, 0, 0);
-    } else if (mode == 1) {
-        // 普通模式，关闭流控等
-        ikcp_nodelay(kcp1, 0, 10, 0, 1);
-        ikcp_nodelay(kcp2, 0, 10, 0, 1);
-    } else {
-        // 启动快速模式
-        // 第二个参数 nodelay-启用以后若干常规加速将启动
-        // 第三个参数 interval为内部处理时钟，默认设置为 10ms
-        // 第四个参数 resend为快速重传指标，设置为2
-        // 第五个参数 为是否禁用常规流控，这里禁止
-        ikcp_nodelay(kcp1, 2, 10, 2, 1);
-        ikcp_nodelay(kcp2, 2, 10, 2, 1);
-        kcp1->rx_minrto = 10;
-        kcp1->fastresend = 1;
+    // 而考虑到丢包重发，默认最大收发窗口为128
+    ikcp_wndsize(kcp1, config.wnd, config.wnd);
+    ikcp_wndsize(kcp2, config.wnd, config.wnd);
+    ikcp_setmtu(kcp1, config.mtu);
+    ikcp_setmtu(kcp2, config.mtu);
+    ikcp_nodelay(kcp1, config.nodelay, config.interval, config.resend, config.nc);
+    ikcp_nodelay(kcp2, config.nodelay, config.interval, config.resend, config.nc);
+    if (config.minrto > 0) {
+        kcp1->rx_minrto = config.minrto;
+        kcp2->rx_minrto = config.minrto;
     }
 
-    char buffer[2000];
+    char buffer[4096];
+    int size = config.size < 8 ? 8 : (config.size > 2048 ? 2048 : config.size);
     int hr;
 
-    IUINT32 ts1 = iclock();
+    IUINT32 ts1 = current;
+    // 链路太差时（比如 100% 丢包、带宽或队列上限太小）回射永远收不齐，
+    // 超过发送时长的 10 倍再加 60 秒就放弃，count 置 -1，已收到的 rtt 照样统计
+    IINT64 limit = (IINT64) packets * config.period * 10 + 60000;
 
     while (1) {
-        isleep(1);
-        current = iclock();
-        ikcp_update(kcp1, iclock());
-        ikcp_update(kcp2, iclock());
+        if (virtualClock) {
+            // 虚拟时钟直接跳到下一个事件
+            SetVirtualClock(NextEvent(kcp1, kcp2, slap));
+        } else {
+            isleep(1);
+        }
+        current = Now();
+        ikcp_update(kcp1, current);
+        ikcp_update(kcp2, current);
 
-        // 每隔 20ms，kcp1发送数据
-        for (; current >= slap; slap += 20) {
+        // 每隔 period ms，kcp1发送数据
+        for (; current >= slap; slap += config.period) {
             ((IUINT32 *) buffer)[0] = index++;
             ((IUINT32 *) buffer)[1] = current;
 
             // 发送上层协议包
-            ikcp_send(kcp1, buffer, 8);
+            ikcp_send(kcp1, buffer, size);
         }
 
         // 处理虚拟网络：检测是否有udp包从p1->p2
         while (1) {
-            hr = vnet->Receiver(1, buffer, 2000);
+            hr = Receiver(1, buffer, sizeof(buffer));
             if (hr < 0) break;
             // 如果 p2收到udp，则作为下层协议输入到kcp2
             ikcp_input(kcp2, buffer, hr);
@@ -173,7 +341,7 @@ void KcpEmulator::KcpRun(int mode)
 
         // 处理虚拟网络：检测是否有udp包从p2->p1
         while (1) {
-            hr = vnet->Receiver(0, buffer, 2000);
+            hr = Receiver(0, buffer, sizeof(buffer));
             if (hr < 0) break;
             // 如果 p1收到udp，则作为下层协议输入到kcp1
             ikcp_input(kcp1, buffer, hr);
@@ -181,7 +349,7 @@ void KcpEmulator::KcpRun(int mode)
 
         // kcp2接收到任何包都返回回去
         while (1) {
-            hr = ikcp_recv(kcp2, buffer, 10);
+            hr = ikcp_recv(kcp2, buffer, sizeof(buffer));
             // 没有收到包就退出
             if (hr < 0) break;
             // 如果收到包就回射
@@ -189,8 +357,9 @@ void KcpEmulator::KcpRun(int mode)
         }
 
         // kcp1收到kcp2的回射数据
+        bool broken = false;
         while (1) {
-            hr = ikcp_recv(kcp1, buffer, 10);
+            hr = ikcp_recv(kcp1, buffer, sizeof(buffer));
             // 没有收到包就退出
             if (hr < 0) break;
             IUINT32 sn = *(IUINT32 *) (buffer + 0);
@@ -199,29 +368,215 @@ void KcpEmulator::KcpRun(int mode)
 
             if (sn != next) {
                 // 如果收到的包不连续
-                printf("ERROR sn %d<->%d\n", (int) count, (int) next);
-                return;
+                printf("ERROR sn %d<->%d\n", (int) stat.count, (int) next);
+                broken = true;
+                break;
             }
 
             next++;
-            sumrtt += rtt;
-            count++;
-            if (rtt > (IUINT32) maxrtt) maxrtt = rtt;
+            stat.sumrtt += rtt;
+            stat.count++;
+            rtts.push_back(rtt);
+            if (rtt > (IUINT32) stat.maxrtt) stat.maxrtt = rtt;
 
-            printf("[RECV] mode=%d sn=%d rtt=%d\n", mode, (int) sn, (int) rtt);
+            if (!virtualClock) {
+                printf("[RECV] mode=%d sn=%d rtt=%d\n", mode, (int) sn, (int) rtt);
+            }
+        }
+        if (broken) {
+            stat.count = -1;
+            break;
+        }
+        if (next > (IUINT32) packets) break;
+        if ((IINT64) (IUINT32) (current - ts1) > limit) {
+            stat.count = -1;
+            break;
         }
-        if (next > 1000) break;
     }
 
-    ts1 = iclock() - ts1;
+    stat.elapsed = Now() - ts1;
+    stat.tx = tx1;
+    if (!rtts.empty()) {
+        std::sort(rtts.begin(), rtts.end());
+        stat.p50 = rtts[rtts.size() * 50 / 100];
+        stat.p90 = rtts[rtts.size() * 90 / 100];
+        stat.p99 = rtts[rtts.size() * 99 / 100];
+        IINT64 payload = (IINT64) rtts.size() * size;
+        if (stat.elapsed > 0) stat.goodput = payload * 1000.0 / stat.elapsed;
+        stat.overhead = wire * 1.0 / (payload * 2);
+    }
+    IINT64 segments = (IINT64) maxsn[0] + maxsn[1];
+    if (segments > 0) stat.retrans = (pushes - segments) * 1.0 / segments;
 
     ikcp_release(kcp1);
     ikcp_release(kcp2);
+    return stat;
+}
 
-    const char *names[3] = {"default", "normal", "fast"};
-    printf("%s mode result (%dms):\n", names[mode], (int) ts1);
-    printf("avgrtt=%d maxrtt=%d tx=%d\n", (int) (sumrtt / count), (int) maxrtt, (int) vnet->tx1);
-    printf("press enter to next ...\n");
-    char ch;
-    scanf("%c", &ch);
+namespace {
+    const IUINT8 RING_CMD_PUSH = 81;
+    const IUINT8 RING_CMD_ACK = 82;
+
+    int ring_output(const char *, int, ikcpcb *, void *)
+    {
+        return 0;
+    }
+
+    void ring_encode(std::vector<char> &packet, IUINT32 conv, IUINT8 cmd, IUINT32 ts, IUINT32 sn,
+                     IUINT32 una, IUINT8 payload, bool data)
+    {
+        IUINT32 fields[] = {conv, ts, sn, una, (IUINT32) (data ? 1 : 0)};
+        size_t base = packet.size();
+        packet.resize(base + 24 + (data ? 1 : 0));
+        char *out = &packet[base];
+        for (int i = 0; i < 4; i++) out[i] = (char) (fields[0] >> (i * 8));
+        out[4] = (char) cmd;
+        out[5] = 0;                         // frg
+        out[6] = (char) 0x00;               // wnd 1024
+        out[7] = (char) 0x04;
+        for (int f = 1; f < 5; f++) {
+            for (int i = 0; i < 4; i++) out[4 + f * 4 + i] = (char) (fields[f] >> (i * 8));
+        }
+        if (data) out[24] = (char) payload;
+    }
+
+    // 环里每个非空槽都对应链表里 sn 相同的段，链表里每个段都在自己的槽里
+    bool ring_agrees(IKCPSEG **ring, IUINT32 mask, const struct IQUEUEHEAD *head, IUINT32 count)
+    {
+        IUINT32 listed = 0, slots = 0;
+        for (const struct IQUEUEHEAD *p = head->next; p != head; p = p->next) {
+            IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+            if (ring[seg->sn & mask] != seg) return false;
+            listed++;
+        }
+        for (IUINT32 i = 0; i <= mask; i++) {
+            if (ring[i] != NULL) slots++;
+        }
+        return listed == count && slots == count;
+    }
+
+    std::vector<IUINT32> ring_list(const struct IQUEUEHEAD *head, IUINT32 base)
+    {
+        std::vector<IUINT32> sns;
+        for (const struct IQUEUEHEAD *p = head->next; p != head; p = p->next) {
+            sns.push_back(iqueue_entry(p, IKCPSEG, node)->sn - base);
+        }
+        return sns;
+    }
+}
+
+int KcpEmulator::RingCheck(unsigned int seed, int rounds, int steps)
+{
+    std::mt19937 rng(seed);
+    int mismatches = 0;
+    std::vector<char> packet;
+    char buffer[64] = {};
+
+    for (int round = 0; round < rounds && mismatches == 0; round++) {
+        // 起点随机，一半靠近 2^32 让 sn 回绕
+        IUINT32 base = (round & 1) ? 0xffffffffu - (rng() % 4096) : rng();
+        IUINT32 rcvwnd = (round & 2) ? 512 : 128;
+        IUINT32 current = 0;
+        ikcpcb *snd = ikcp_create(0x5a5a, NULL);
+        ikcpcb *rcv = ikcp_create(0x5a5a, NULL);
+        snd->output = ring_output;
+        rcv->output = ring_output;
+        ikcp_wndsize(snd, 1024, 128);
+        ikcp_wndsize(rcv, 128, rcvwnd);
+        ikcp_nodelay(snd, 1, 10, 2, 1);
+        snd->snd_una = snd->snd_nxt = base;
+        rcv->rcv_nxt = base;
+
+        // 参照：sn 相对 base 的偏移，snd_buf 按 sn 有序，rcv_buf 按 sn 排序后比较
+        std::deque<IUINT32> refSnd;
+        IUINT32 refSndNxt = 0;
+        std::set<IUINT32> refRcv;
+        std::deque<IUINT32> refQueue;
+        IUINT32 refRcvNxt = 0;
+
+        for (int step = 0; step < steps; step++) {
+            current += 10;
+            int op = (int) (rng() % 8);
+            packet.clear();
+            if (op == 0) {
+                // 发送若干消息，flush 把它们从 snd_queue 移进 snd_buf
+                int count = (int) (rng() % 64);
+                for (int i = 0; i < count; i++) ikcp_send(snd, buffer, 1);
+                ikcp_update(snd, current);
+                for (; refSndNxt != snd->snd_nxt - base; refSndNxt++) refSnd.push_back(refSndNxt);
+            } else if (op < 4) {
+                // 一个包里几个 ack，sn 可能越界或重复，una 多数时候不动
+                IUINT32 una = refSnd.empty() ? refSndNxt : refSnd.front();
+                if (rng() % 10 < 3) una += rng() % 4;
+                int acks = 1 + (int) (rng() % 4);
+                for (int i = 0; i < acks; i++) {
+                    IUINT32 sn = una + (rng() % 160) - 8;
+                    ring_encode(packet, 0x5a5a, RING_CMD_ACK, current, base + sn, base + una, 0, false);
+                }
+                ikcp_input(snd, &packet[0], (long) packet.size());
+                // 原来的链表逻辑：una 之前的全部确认，ack 只删 [snd_una, snd_nxt) 里相同 sn 的段
+                int n = 0;
+                for (size_t off = 0; off < packet.size(); off += 24, n++) {
+                    IUINT32 sn = 0;
+                    for (int i = 0; i < 4; i++) sn |= (IUINT32) (IUINT8) packet[off + 12 + i] << (i * 8);
+                    sn -= base;
+                    while (!refSnd.empty() && (IINT32) (una - refSnd.front()) > 0) refSnd.pop_front();
+                    IUINT32 sndUna = refSnd.empty() ? refSndNxt : refSnd.front();
+                    if ((IINT32) (sn - sndUna) < 0 || (IINT32) (sn - refSndNxt) >= 0) continue;
+                    auto it = std::find(refSnd.begin(), refSnd.end(), sn);
+                    if (it != refSnd.end()) refSnd.erase(it);
+                }
+            } else if (op < 7) {
+                // 乱序、重复、窗口外的数据
+                int pushes = 1 + (int) (rng() % 4);
+                for (int i = 0; i < pushes; i++) {
+                    IUINT32 sn = refRcvNxt + (rng() % (rcvwnd + 8)) - 4;
+                    ring_encode(packet, 0x5a5a, RING_CMD_PUSH, current, base + sn, base, (IUINT8) sn, true);
+                    if ((IINT32) (sn - refRcvNxt) >= 0 && (IINT32) (sn - (refRcvNxt + rcvwnd)) < 0) {
+                        refRcv.insert(sn);
+                    }
+                    while (refQueue.size() < rcvwnd && refRcv.count(refRcvNxt)) {
+                        refRcv.erase(refRcvNxt);
+                        refQueue.push_back(refRcvNxt++);
+                    }
+                }
+                ikcp_input(rcv, &packet[0], (long) packet.size());
+            } else {
+                // 上层取走几条，空出队列后 rcv_buf 继续往前挪；顺便 flush 掉攒下的 ack
+                ikcp_update(rcv, current);
+                int reads = (int) (rng() % 8);
+                for (int i = 0; i < reads && !refQueue.empty(); i++) {
+                    int hr = ikcp_recv(rcv, buffer, sizeof(buffer));
+                    IUINT32 sn = refQueue.front();
+                    refQueue.pop_front();
+                    if (hr != 1 || (IUINT8) buffer[0] != (IUINT8) sn) mismatches++;
+                    while (refQueue.size() < rcvwnd && refRcv.count(refRcvNxt)) {
+                        refRcv.erase(refRcvNxt);
+                        refQueue.push_back(refRcvNxt++);
+                    }
+                }
+            }
+
+            std::vector<IUINT32> sndList = ring_list(&snd->snd_buf, base);
+            std::vector<IUINT32> rcvList = ring_list(&rcv->rcv_buf, base);
+            std::sort(rcvList.begin(), rcvList.end());
+            IUINT32 sndUna = refSnd.empty() ? refSndNxt : refSnd.front();
+            bool same = sndList == std::vector<IUINT32>(refSnd.begin(), refSnd.end())
+                        && rcvList == std::vector<IUINT32>(refRcv.begin(), refRcv.end())
+                        && snd->snd_una - base == sndUna
+                        && rcv->rcv_nxt - base == refRcvNxt
+                        && rcv->nrcv_que == refQueue.size()
+                        && ring_agrees(snd->snd_ring, snd->snd_mask, &snd->snd_buf, snd->nsnd_buf)
+                        && ring_agrees(rcv->rcv_ring, rcv->rcv_mask, &rcv->rcv_buf, rcv->nrcv_buf);
+            if (!same) {
+                LOGE("ring check: seed=%u round=%d step=%d op=%d snd %zu/%zu rcv %zu/%zu", seed, round,
+                     step, op, sndList.size(), refSnd.size(), rcvList.size(), refRcv.size());
+                mismatches++;
+                break;
+            }
+        }
+        ikcp_release(snd);
+        ikcp_release(rcv);
+    }
+    return mismatches;
 }
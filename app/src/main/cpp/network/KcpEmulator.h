@@ -84,6 +84,8 @@ static inline void isleep(unsigned long millisecond)
 
 #include <list>
 #include <vector>
+#include <random>
+#include <queue>
 
 // 带延迟的数据包
 class DelayPacket {
@@ -133,7 +135,7 @@ public:
         seeds.resize(size);
     }
 
-    int random()
+    int random(std::mt19937 &rng)
     {
         int x, i;
         if (seeds.size() == 0) return 0;
@@ -143,7 +145,7 @@ public:
             }
             size = (int) seeds.size();
         }
-        i = rand() % size;
+        i = rng() % size;
         x = seeds[i];
         seeds[i] = seeds[--size];
         return x;
@@ -154,6 +156,62 @@ protected:
     std::vector<int> seeds;
 };
 
+// 延迟抖动的分布
+enum KcpJitter {
+    JITTER_UNIFORM,     // rttmin ~ rttmax 均匀分布
+    JITTER_NORMAL,      // 以 rttmin/rttmax 中点为均值的正态分布
+    JITTER_PARETO       // 长尾分布，偶尔出现很大的延迟
+};
+
+// 网络损伤模型，都是单程的参数，百分比为 0 表示关闭
+struct KcpImpairment {
+    int lostrate = 5;           // 均匀丢包率，没有开启 Gilbert-Elliott 时使用
+    int rttmin = 30;            // 单程延迟最小值 ms
+    int rttmax = 62;            // 单程延迟最大值 ms
+    KcpJitter jitter = JITTER_UNIFORM;
+    int bandwidth = 0;          // 带宽上限 字节/秒，超出部分排队
+    int queuems = 0;            // 排队延迟上限 ms，超过就尾部丢弃，0 不限制
+    double geGood2Bad = 0;      // Gilbert-Elliott：好状态进入坏状态的概率 %
+    double geBad2Good = 0;      // 坏状态恢复的概率 %
+    double geLossGood = 0;      // 好状态下的丢包率 %
+    double geLossBad = 0;       // 坏状态下的丢包率 %
+    double reorder = 0;         // 额外延迟 reorderms 让后面的包超过它的概率 %
+    int reorderms = 0;
+    double duplicate = 0;       // 重复发送的概率 %
+};
+
+// kcp 参数，两个端点使用同样的设置
+struct KcpConfig {
+    int nodelay = 0;
+    int interval = 10;
+    int resend = 0;
+    int nc = 0;
+    int wnd = 128;
+    int mtu = 1400;
+    int minrto = 0;         // 0 使用 ikcp_nodelay 的默认值
+    int size = 8;           // 每个包的字节数，至少 8
+    int period = 20;        // 发送间隔 ms
+
+    // KcpRun 的三种模式：0 默认，1 普通，2 快速
+    static KcpConfig Mode(int mode);
+};
+
+// 一次测试的结果
+struct KcpStat {
+    int mode;
+    int count;              // 回射收齐的包数，乱序或超时没收齐为 -1
+    IINT64 sumrtt;
+    int maxrtt;
+    int tx;
+    IUINT32 elapsed;
+    int p50;
+    int p90;
+    int p99;
+    double goodput;         // 回射成功的有效数据 字节/秒
+    double retrans;         // 重传的数据段 / 数据段
+    double overhead;        // 线路上的字节 / 有效数据字节
+};
+
 // 网络延迟模拟器
 class KcpEmulator {
 public:
@@ -163,6 +221,15 @@ public:
 
     int Receiver(int peer, void *data, int maxsize);
 
+    // 虚拟时钟：不再读系统时间，由测试循环直接跳到下一个事件
+    void SetVirtualClock(IUINT32 now);
+
+    void Seed(unsigned int seed);
+
+    void SetImpairment(const KcpImpairment &impairment);
+
+    IUINT32 Now() const;
+
     virtual ~KcpEmulator();
 
 public:
@@ -170,20 +237,66 @@ public:
     int tx2;
 protected:
     IUINT32 current;
+    bool simulate;
+    std::mt19937 rng;
     int lostrate;
     int rttmin;
     int rttmax;
     int nmax;
-    typedef std::list<DelayPacket *> DelayTunnel;
+    KcpImpairment impair;
+
+    // 按到达时间排序的隧道，同一时间先发先到
+    struct TunnelEntry {
+        IUINT32 ts;
+        IUINT32 seq;
+        DelayPacket *pkt;
+    };
+    struct TunnelLater {
+        bool operator()(const TunnelEntry &a, const TunnelEntry &b) const
+        {
+            IINT32 diff = (IINT32) (a.ts - b.ts);
+            return diff != 0 ? diff > 0 : (IINT32) (a.seq - b.seq) > 0;
+        }
+    };
+    typedef std::priority_queue<TunnelEntry, std::vector<TunnelEntry>, TunnelLater> DelayTunnel;
     DelayTunnel p12;
     DelayTunnel p21;
+    IUINT32 seq;
     Random r12;
     Random r21;
+    bool bad[2];            // Gilbert-Elliott 状态
+    double busy[2];         // 带宽：链路空闲的时间
+
+    // 统计线路上的字节和数据段，用来算重传率和带宽开销
+    IINT64 wire;
+    IINT64 pushes;
+    IUINT32 maxsn[2];
+
+    void Account(int peer, const void *data, int size);
+
+    bool Lost(int peer);
+
+    bool Chance(double percent);
+
+    IUINT32 Delay();
 
 private:
     const int RECVWND = 128;
+
+    KcpStat Run(int mode, const KcpConfig &config, int packets, bool simulate);
+
+    IUINT32 NextEvent(ikcpcb *kcp1, ikcpcb *kcp2, IUINT32 slap) const;
 public:
     void KcpRun(int mode);
+
+    // 虚拟时钟 + 固定随机种子，结果可复现，1000个包只需几毫秒 cpu
+    KcpStat KcpSimulate(int mode, unsigned int seed, int packets = 1000);
+
+    KcpStat KcpSimulate(const KcpConfig &config, unsigned int seed, int packets = 1000);
+
+    // 差分检查：随机的 ack/una/乱序数据包同时喂给 ikcp（按 sn 索引的环）和按原始链表逻辑写的参照，
+    // 每一步比较两边的 snd_buf/rcv_buf，并检查环和链表一致，返回不一致的次数，0 为通过
+    static int RingCheck(unsigned int seed, int rounds = 20, int steps = 2000);
 };
 
 #endif
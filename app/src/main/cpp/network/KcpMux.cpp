@@ -0,0 +1,494 @@
+#include "KcpMux.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+#ifndef LOG_TAG
+#define LOG_TAG "KcpMux"
+#endif
+
+#include <Utils/logging.h>
+
+namespace {
+    // bionic only declares sendmmsg from API 21
+    inline int SendMmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags)
+    {
+#if defined(__ANDROID_API__) && __ANDROID_API__ < 21
+        return static_cast<int>(syscall(__NR_sendmmsg, sock, msgs, vlen, flags));
+#else
+        return sendmmsg(sock, msgs, vlen, flags);
+#endif
+    }
+
+    // kcp segment header, the smallest valid datagram
+    constexpr int KCP_OVERHEAD = 24;
+    constexpr int MAX_WAIT_MS = 100;
+    constexpr int PACKET_SIZE = 65536;
+    constexpr size_t MIN_SLOTS = 64;
+    constexpr IUINT32 EXPIRE_PERIOD = 1000;
+    constexpr unsigned short BENCH_PORT = 8903;
+
+    inline size_t Hash(IUINT32 conv)
+    {
+        IUINT32 h = conv * 0x9E3779B1u;
+        return h ^ (h >> 16);
+    }
+}
+
+KcpMux::KcpMux(const KcpConfig &config, size_t maxSessions, IUINT32 idleMs, int batch) :
+        m_config(config),
+        m_maxSessions(maxSessions),
+        m_idleMs(idleMs),
+        m_batch(batch),
+        m_slots(MIN_SLOTS),
+        m_scheduler(iclock()),
+        m_recvBuf(PACKET_SIZE)
+{
+    if (m_batch > 0) {
+        m_iovs.resize(m_batch);
+        m_msgs.resize(m_batch);
+        for (int i = 0; i < m_batch; i++) {
+            memset(&m_msgs[i], 0, sizeof(struct mmsghdr));
+            m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+            m_msgs[i].msg_hdr.msg_iovlen = 1;
+            m_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+    }
+}
+
+KcpMux::~KcpMux()
+{
+    for (Slot &slot : m_slots) {
+        if (slot.state == SLOT_USED) {
+            m_scheduler.Remove(slot.session->kcp);
+            ikcp_release(slot.session->kcp);
+            delete slot.session;
+        }
+    }
+    if (m_socket >= 0) {
+        close(m_socket);
+    }
+}
+
+int KcpMux::Open(unsigned short port)
+{
+    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_socket < 0) {
+        LOGE("socket: %s", strerror(errno));
+        return -1;
+    }
+    int flags = fcntl(m_socket, F_GETFL, 0);
+    fcntl(m_socket, F_SETFL, flags | O_NONBLOCK);
+    int opt = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const void *) &opt, sizeof(opt));
+    // all peers share this queue
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, (const void *) &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(m_socket, (struct sockaddr *) &local, sizeof(local)) < 0) {
+        LOGE("bind %d: %s", port, strerror(errno));
+        close(m_socket);
+        m_socket = -1;
+        return -2;
+    }
+    LOGI("kcp mux on [%d], %zu sessions at most.", port, m_maxSessions);
+    // armed here, not in Run: a Finish that comes before the run thread starts must stick
+    m_running = true;
+    return m_socket;
+}
+
+void KcpMux::RegisterCallback(KCPMUXHOOK hook, void *user)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_hook = hook;
+    m_user = user;
+}
+
+int KcpMux::Output(const char *buf, int len, ikcpcb *, void *user)
+{
+    auto *session = static_cast<Session *>(user);
+    // a full socket buffer is a lost packet, kcp resends it
+    ssize_t res = ::sendto(session->mux->m_socket, buf, static_cast<size_t>(len), 0,
+                           (const struct sockaddr *) &session->peer, sizeof(session->peer));
+    return res < 0 ? -1 : 0;
+}
+
+int KcpMux::OutputBatch(const char **bufs, const int *lens, int count, ikcpcb *, void *user)
+{
+    auto *session = static_cast<Session *>(user);
+    KcpMux *mux = session->mux;
+    for (int i = 0; i < count; i++) {
+        mux->m_iovs[i].iov_base = const_cast<char *>(bufs[i]);
+        mux->m_iovs[i].iov_len = static_cast<size_t>(lens[i]);
+        mux->m_msgs[i].msg_hdr.msg_name = &session->peer;
+    }
+    int sent = 0;
+    while (sent < count) {
+        int num = SendMmsg(mux->m_socket, &mux->m_msgs[sent], static_cast<unsigned int>(count - sent), 0);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        sent += num;
+    }
+    return sent < count ? -1 : 0;
+}
+
+size_t KcpMux::Probe(IUINT32 conv) const
+{
+    size_t mask = m_slots.size() - 1;
+    size_t index = Hash(conv) & mask;
+    while (m_slots[index].state != SLOT_EMPTY) {
+        if (m_slots[index].state == SLOT_USED && m_slots[index].conv == conv) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+KcpMux::Session *KcpMux::Find(IUINT32 conv) const
+{
+    const Slot &slot = m_slots[Probe(conv)];
+    return slot.state == SLOT_USED ? slot.session : nullptr;
+}
+
+void KcpMux::Rehash(size_t capacity)
+{
+    std::vector<Slot> slots(capacity);
+    slots.swap(m_slots);
+    m_deleted = 0;
+    for (const Slot &slot : slots) {
+        if (slot.state == SLOT_USED) {
+            m_slots[Probe(slot.conv)] = slot;
+        }
+    }
+}
+
+KcpMux::Session *KcpMux::Create(IUINT32 conv, const struct sockaddr_in &peer, IUINT32 current)
+{
+    if (m_count >= m_maxSessions) {
+        return nullptr;
+    }
+    // keep the load with tombstones under 3/4 so probes stay short
+    if ((m_count + m_deleted + 1) * 4 > m_slots.size() * 3) {
+        size_t capacity = m_slots.size();
+        while ((m_count + 1) * 2 > capacity) {
+            capacity <<= 1;
+        }
+        Rehash(capacity);
+    }
+    auto *session = new Session();
+    session->conv = conv;
+    session->peer = peer;
+    session->active = current;
+    session->mux = this;
+    session->kcp = ikcp_create(conv, session);
+    ikcp_setoutput(session->kcp, Output);
+    if (m_batch > 0) {
+        ikcp_setoutputv(session->kcp, OutputBatch, m_batch);
+    }
+    ikcp_wndsize(session->kcp, m_config.wnd, m_config.wnd);
+    ikcp_setmtu(session->kcp, m_config.mtu);
+    ikcp_nodelay(session->kcp, m_config.nodelay, m_config.interval, m_config.resend, m_config.nc);
+    if (m_config.minrto > 0) {
+        session->kcp->rx_minrto = m_config.minrto;
+    }
+    Slot &slot = m_slots[Probe(conv)];
+    slot.conv = conv;
+    slot.state = SLOT_USED;
+    slot.session = session;
+    m_count++;
+    m_scheduler.Add(session->kcp, current);
+    return session;
+}
+
+void KcpMux::Release(Session *session)
+{
+    Slot &slot = m_slots[Probe(session->conv)];
+    slot.state = SLOT_DELETED;
+    slot.session = nullptr;
+    m_count--;
+    m_deleted++;
+    m_scheduler.Remove(session->kcp);
+    ikcp_release(session->kcp);
+    delete session;
+}
+
+int KcpMux::Send(IUINT32 conv, const char *data, int size)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    Session *session = Find(conv);
+    if (session == nullptr) {
+        return -1;
+    }
+    int ret = ikcp_send(session->kcp, data, size);
+    if (ret >= 0) {
+        ikcp_flush(session->kcp);
+        m_scheduler.Touch(session->kcp, iclock());
+    }
+    return ret;
+}
+
+void KcpMux::Input(const char *data, int size, const struct sockaddr_in &peer, IUINT32 current)
+{
+    if (size < KCP_OVERHEAD) {
+        m_rejected++;
+        return;
+    }
+    IUINT32 conv = ikcp_getconv(data);
+    Session *session = Find(conv);
+    bool created = false;
+    if (session == nullptr) {
+        session = Create(conv, peer, current);
+        if (session == nullptr) {
+            m_rejected++;
+            return;
+        }
+        created = true;
+    }
+    if (ikcp_input(session->kcp, data, size) < 0) {
+        m_rejected++;
+        if (created) {
+            Release(session);
+        }
+        return;
+    }
+    // follow the peer across nat rebinding
+    session->peer = peer;
+    session->active = current;
+    m_scheduler.Touch(session->kcp, current);
+    if (ikcp_peeksize(session->kcp) >= 0) {
+        m_ready.push_back(session);
+    }
+}
+
+void KcpMux::Deliver(Session *session)
+{
+    while (true) {
+        KCPMUXHOOK hook;
+        void *user;
+        int size;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            hook = m_hook;
+            user = m_user;
+            if (hook == nullptr) {
+                return;
+            }
+            size = ikcp_peeksize(session->kcp);
+            if (size < 0) {
+                return;
+            }
+            if (m_message.size() < (size_t) size) {
+                m_message.resize(size);
+            }
+            size = ikcp_recv(session->kcp, m_message.data(), size);
+        }
+        if (size < 0) {
+            return;
+        }
+        hook(session->conv, m_message.data(), size, user);
+    }
+}
+
+void KcpMux::Expire(IUINT32 current)
+{
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        Session *session = m_slots[i].state == SLOT_USED ? m_slots[i].session : nullptr;
+        if (session == nullptr) {
+            continue;
+        }
+        if ((IINT32) (current - session->active) > (IINT32) m_idleMs
+            || session->kcp->state == (IUINT32) -1) {
+            LOGI("kcp mux release conv %x, %zu left.", session->conv, m_count - 1);
+            Release(session);
+        }
+    }
+    if (m_deleted > m_count && m_slots.size() > MIN_SLOTS) {
+        size_t capacity = MIN_SLOTS;
+        while (m_count * 2 > capacity) {
+            capacity <<= 1;
+        }
+        Rehash(capacity);
+    }
+}
+
+int KcpMux::Run()
+{
+    if (m_socket < 0) {
+        LOGE("kcp mux is not open.");
+        return -1;
+    }
+    IUINT32 expired = iclock();
+    while (m_running) {
+        int wait;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            wait = m_scheduler.Timeout(iclock(), MAX_WAIT_MS);
+        }
+        struct pollfd pfd = {m_socket, POLLIN, 0};
+        int res = poll(&pfd, 1, wait);
+        if (res < 0 && errno != EINTR) {
+            LOGE("poll: %s", strerror(errno));
+            break;
+        }
+        IUINT32 current = iclock();
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            while (res > 0) {
+                struct sockaddr_in peer{};
+                socklen_t len = sizeof(peer);
+                ssize_t size = ::recvfrom(m_socket, m_recvBuf.data(), m_recvBuf.size(), 0,
+                                          (struct sockaddr *) &peer, &len);
+                if (size < 0) {
+                    break;
+                }
+                Input(m_recvBuf.data(), static_cast<int>(size), peer, current);
+            }
+            m_scheduler.Update(current);
+        }
+        // only this thread releases sessions, so the pointers hold while unlocked
+        for (Session *session : m_ready) {
+            Deliver(session);
+        }
+        m_ready.clear();
+        if (current - expired >= EXPIRE_PERIOD) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            Expire(current);
+            expired = current;
+        }
+    }
+    return 0;
+}
+
+void KcpMux::Finish()
+{
+    m_running = false;
+}
+
+size_t KcpMux::Size()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_count;
+}
+
+size_t KcpMux::Rejected()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_rejected;
+}
+
+namespace {
+    struct BenchClient {
+        int sock;
+        ikcpcb *kcp;
+        int echoed;
+        long long sumRtt;
+    };
+
+    long long MicroNow()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int BenchOutput(const char *buf, int len, ikcpcb *, void *user)
+    {
+        ::send(static_cast<BenchClient *>(user)->sock, buf, static_cast<size_t>(len), 0);
+        return 0;
+    }
+
+    void BenchEcho(IUINT32 conv, const char *data, int size, void *user)
+    {
+        static_cast<KcpMux *>(user)->Send(conv, data, size);
+    }
+}
+
+int KcpMux::Benchmark(int sessions, int rounds)
+{
+    const IUINT32 base = 0x10000;
+    KcpMux mux;
+    if (mux.Open(BENCH_PORT) < 0) {
+        return -1;
+    }
+    mux.RegisterCallback(BenchEcho, &mux);
+    std::thread server(&KcpMux::Run, &mux);
+
+    // every client session shares one socket, the mux only sees different convs
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const void *) &rcvbuf, sizeof(rcvbuf));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    connect(sock, (struct sockaddr *) &addr, sizeof(addr));
+
+    KcpConfig config = KcpConfig::Mode(2);
+    std::vector<BenchClient> clients(sessions);
+    for (int i = 0; i < sessions; i++) {
+        clients[i] = {sock, ikcp_create(base + i, &clients[i]), 0, 0};
+        ikcp_setoutput(clients[i].kcp, BenchOutput);
+        ikcp_nodelay(clients[i].kcp, config.nodelay, config.interval, config.resend, config.nc);
+        clients[i].kcp->rx_minrto = config.minrto;
+    }
+
+    std::vector<char> buffer(PACKET_SIZE);
+    long long start = MicroNow();
+    int total = 0;
+    for (int round = 0; round < rounds; round++) {
+        long long now = MicroNow();
+        for (BenchClient &client : clients) {
+            ikcp_send(client.kcp, reinterpret_cast<const char *>(&now), sizeof(now));
+            ikcp_flush(client.kcp);
+        }
+        int expect = (round + 1) * sessions;
+        while (total < expect && MicroNow() - now < 3000000) {
+            struct pollfd pfd = {sock, POLLIN, 0};
+            poll(&pfd, 1, 5);
+            ssize_t size;
+            while ((size = ::recv(sock, buffer.data(), buffer.size(), 0)) >= KCP_OVERHEAD) {
+                IUINT32 index = ikcp_getconv(buffer.data()) - base;
+                if (index < (IUINT32) sessions) {
+                    ikcp_input(clients[index].kcp, buffer.data(), size);
+                }
+            }
+            IUINT32 current = iclock();
+            for (BenchClient &client : clients) {
+                ikcp_update(client.kcp, current);
+                long long sent;
+                while (ikcp_recv(client.kcp, reinterpret_cast<char *>(&sent), sizeof(sent)) > 0) {
+                    client.sumRtt += MicroNow() - sent;
+                    client.echoed++;
+                    total++;
+                }
+            }
+        }
+    }
+    long long elapsed = MicroNow() - start;
+    long long sumRtt = 0;
+    for (BenchClient &client : clients) {
+        sumRtt += client.sumRtt;
+        ikcp_release(client.kcp);
+    }
+    close(sock);
+    size_t opened = mux.Size();
+    mux.Finish();
+    server.join();
+    LOGI("kcp mux: %zu sessions on one port, %d/%d echoed in %lldus, avg rtt = %lldus, %zu rejected.",
+         opened, total, sessions * rounds, elapsed, total > 0 ? sumRtt / total : 0, mux.Rejected());
+    return total;
+}
@@ -0,0 +1,106 @@
+#ifndef DEVIDROID_KCPMUX_H
+#define DEVIDROID_KCPMUX_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "kcp/ikcp.h"
+#include "KcpEmulator.h"
+#include "KcpScheduler.h"
+
+// one received kcp message of session 'conv', data is only valid inside the hook
+typedef void(*KCPMUXHOOK)(IUINT32 conv, const char *data, int size, void *user);
+
+// many kcp sessions behind one udp port, told apart by the conv of each datagram;
+// sessions are created when a peer first speaks and released after 'idleMs' of silence
+class KcpMux {
+public:
+    explicit KcpMux(const KcpConfig &config = KcpConfig::Mode(2), size_t maxSessions = 1024,
+                    IUINT32 idleMs = 30000, int batch = 32);
+
+    virtual ~KcpMux();
+
+    int Open(unsigned short port);
+
+    void RegisterCallback(KCPMUXHOOK hook, void *user = nullptr);
+
+    // thread safe, only to sessions a peer has opened
+    int Send(IUINT32 conv, const char *data, int size);
+
+    // receive, dispatch and update sessions from a timing wheel until Finish
+    int Run();
+
+    void Finish();
+
+    size_t Size();
+
+    // datagrams dropped as malformed or over the session limit
+    size_t Rejected();
+
+    // 'sessions' convs from one client socket echo 'rounds' pings through a mux
+    static int Benchmark(int sessions = 256, int rounds = 10);
+
+private:
+    struct Session {
+        IUINT32 conv;
+        ikcpcb *kcp;
+        struct sockaddr_in peer;
+        IUINT32 active;
+        KcpMux *mux;
+    };
+
+    enum SlotState {
+        SLOT_EMPTY, SLOT_USED, SLOT_DELETED
+    };
+
+    // open addressing with linear probing, power of two capacity
+    struct Slot {
+        IUINT32 conv;
+        int state;
+        Session *session;
+    };
+
+    static int OutputBatch(const char **bufs, const int *lens, int count, ikcpcb *kcp, void *user);
+
+    static int Output(const char *buf, int len, ikcpcb *kcp, void *user);
+
+    size_t Probe(IUINT32 conv) const;
+
+    Session *Find(IUINT32 conv) const;
+
+    Session *Create(IUINT32 conv, const struct sockaddr_in &peer, IUINT32 current);
+
+    void Release(Session *session);
+
+    void Rehash(size_t capacity);
+
+    void Input(const char *data, int size, const struct sockaddr_in &peer, IUINT32 current);
+
+    void Deliver(Session *session);
+
+    void Expire(IUINT32 current);
+
+    KcpConfig m_config;
+    const size_t m_maxSessions;
+    const IUINT32 m_idleMs;
+    const int m_batch;
+    int m_socket = -1;
+    std::mutex m_lock;
+    KCPMUXHOOK m_hook = nullptr;
+    void *m_user = nullptr;
+    std::vector<Slot> m_slots;
+    size_t m_count = 0;
+    size_t m_deleted = 0;
+    size_t m_rejected = 0;
+    KcpScheduler m_scheduler;
+    std::vector<Session *> m_ready;
+    std::vector<char> m_recvBuf;
+    std::vector<char> m_message;
+    std::vector<struct iovec> m_iovs;
+    std::vector<struct mmsghdr> m_msgs;
+    std::atomic<bool> m_running{false};
+};
+
+#endif //DEVIDROID_KCPMUX_H
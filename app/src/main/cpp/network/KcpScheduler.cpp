@@ -0,0 +1,234 @@
+#include "KcpScheduler.h"
+#include <ctime>
+#include <chrono>
+#include <vector>
+
+#ifndef LOG_TAG
+#define LOG_TAG "KcpScheduler"
+#endif
+
+#include <Utils/logging.h>
+
+namespace {
+    int NullOutput(const char *, int, ikcpcb *, void *)
+    {
+        return 0;
+    }
+}
+
+KcpScheduler::KcpScheduler(IUINT32 current) : m_current(current)
+{
+    for (Node &head : m_root) {
+        head.prev = head.next = &head;
+    }
+    for (auto &level : m_levels) {
+        for (Node &head : level) {
+            head.prev = head.next = &head;
+        }
+    }
+}
+
+KcpScheduler::~KcpScheduler()
+{
+    for (auto &item : m_nodes) {
+        delete item.second;
+    }
+}
+
+void KcpScheduler::Insert(Node *node)
+{
+    // never schedule into the past, the slot of m_current - 1 has been run
+    if ((IINT32) (node->expire - m_current) < 0) {
+        node->expire = m_current;
+    }
+    IUINT32 expire = node->expire;
+    IUINT32 delta = expire - m_current;
+    Node *head;
+    if (delta < ROOT_SIZE) {
+        head = &m_root[expire & (ROOT_SIZE - 1)];
+    } else {
+        int level = 0;
+        IUINT32 span = ROOT_SIZE << LEVEL_BITS;
+        while (level < LEVELS - 2 && delta >= span) {
+            span <<= LEVEL_BITS;
+            level++;
+        }
+        if (delta >= span) {
+            expire = m_current + span - 1;
+            node->expire = expire;
+        }
+        int shift = ROOT_BITS + level * LEVEL_BITS;
+        head = &m_levels[level][(expire >> shift) & (LEVEL_SIZE - 1)];
+    }
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void KcpScheduler::Unlink(Node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = node;
+}
+
+void KcpScheduler::Cascade(int level)
+{
+    int shift = ROOT_BITS + level * LEVEL_BITS;
+    Node *head = &m_levels[level][(m_current >> shift) & (LEVEL_SIZE - 1)];
+    Node list = *head;
+    if (list.next == head) {
+        return;
+    }
+    // detach the slot, then spread its nodes over the lower levels
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head->prev = head->next = head;
+    while (list.next != &list) {
+        Node *node = list.next;
+        Unlink(node);
+        Insert(node);
+    }
+}
+
+void KcpScheduler::Add(ikcpcb *kcp, IUINT32 current)
+{
+    if (m_nodes.count(kcp) > 0) {
+        Touch(kcp, current);
+        return;
+    }
+    auto *node = new Node{kcp, current, nullptr, nullptr};
+    m_nodes[kcp] = node;
+    Insert(node);
+}
+
+void KcpScheduler::Remove(ikcpcb *kcp)
+{
+    auto it = m_nodes.find(kcp);
+    if (it == m_nodes.end()) {
+        return;
+    }
+    Unlink(it->second);
+    delete it->second;
+    m_nodes.erase(it);
+}
+
+void KcpScheduler::Touch(ikcpcb *kcp, IUINT32 current)
+{
+    auto it = m_nodes.find(kcp);
+    if (it == m_nodes.end()) {
+        return;
+    }
+    Node *node = it->second;
+    if ((IINT32) (node->expire - current) <= 0) {
+        return;
+    }
+    Unlink(node);
+    node->expire = current;
+    Insert(node);
+}
+
+int KcpScheduler::Update(IUINT32 current)
+{
+    int count = 0;
+    while ((IINT32) (current - m_current) >= 0) {
+        IUINT32 index = m_current & (ROOT_SIZE - 1);
+        if (index == 0) {
+            for (int level = 0; level < LEVELS - 1; level++) {
+                Cascade(level);
+                int shift = ROOT_BITS + level * LEVEL_BITS;
+                if (((m_current >> shift) & (LEVEL_SIZE - 1)) != 0) {
+                    break;
+                }
+            }
+        }
+        Node *head = &m_root[index];
+        Node list = *head;
+        IUINT32 tick = m_current++;
+        if (list.next == head) {
+            continue;
+        }
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head->prev = head->next = head;
+        while (list.next != &list) {
+            Node *node = list.next;
+            Unlink(node);
+            // sessions run at their own deadline, even when the wheel catches up late
+            ikcp_update(node->kcp, current);
+            node->expire = ikcp_check(node->kcp, current);
+            if ((IINT32) (node->expire - tick) <= 0) {
+                node->expire = tick + 1;
+            }
+            Insert(node);
+            count++;
+        }
+    }
+    return count;
+}
+
+int KcpScheduler::Timeout(IUINT32 current, int maxWait) const
+{
+    int wait = (IINT32) (m_current - current);
+    if (wait < 0) {
+        return 0;
+    }
+    // only the first level is looked at, upper levels are at least a root turn away
+    for (IUINT32 i = 0; i < ROOT_SIZE && (int) i + wait < maxWait; i++) {
+        const Node *head = &m_root[(m_current + i) & (ROOT_SIZE - 1)];
+        if (head->next != head) {
+            return wait + (int) i;
+        }
+    }
+    return maxWait;
+}
+
+size_t KcpScheduler::Size() const
+{
+    return m_nodes.size();
+}
+
+void KcpScheduler::Benchmark(int seconds)
+{
+    const int counts[] = {10, 100, 1000, 10000};
+    const IUINT32 duration = seconds * 1000;
+    for (int count : counts) {
+        double perSession[2] = {};
+        for (int mode = 0; mode < 2; mode++) {
+            IUINT32 current = 0;
+            std::vector<ikcpcb *> sessions;
+            for (int i = 0; i < count; i++) {
+                ikcpcb *kcp = ikcp_create(i, nullptr);
+                ikcp_setoutput(kcp, NullOutput);
+                sessions.push_back(kcp);
+            }
+            KcpScheduler scheduler(current);
+            if (mode == 1) {
+                for (ikcpcb *kcp : sessions) {
+                    scheduler.Add(kcp, current);
+                }
+            }
+            std::clock_t start = std::clock();
+            long long updates = 0;
+            for (; current < duration; current++) {
+                if (mode == 0) {
+                    for (ikcpcb *kcp : sessions) {
+                        ikcp_update(kcp, current);
+                    }
+                    updates += count;
+                } else {
+                    updates += scheduler.Update(current);
+                }
+            }
+            double cpu = (std::clock() - start) * 1e9 / CLOCKS_PER_SEC;
+            perSession[mode] = cpu / count / seconds;
+            LOGI("kcp %s: %d idle sessions, %lld updates, %.0f ns cpu per session per second.",
+                 mode == 0 ? "1ms loop" : "timer wheel", count, updates, perSession[mode]);
+            for (ikcpcb *kcp : sessions) {
+                scheduler.Remove(kcp);
+                ikcp_release(kcp);
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef DEVIDROID_KCPSCHEDULER_H
+#define DEVIDROID_KCPSCHEDULER_H
+
+#include <unordered_map>
+#include "kcp/ikcp.h"
+
+// hierarchical timing wheel of kcp sessions, each one parked until its ikcp_check deadline;
+// 1ms ticks, 256 slots on the first level and 64 on each of the three upper levels
+class KcpScheduler {
+public:
+    KcpScheduler(IUINT32 current);
+
+    virtual ~KcpScheduler();
+
+    void Add(ikcpcb *kcp, IUINT32 current);
+
+    void Remove(ikcpcb *kcp);
+
+    // after ikcp_input/ikcp_send, update the session on the next tick
+    void Touch(ikcpcb *kcp, IUINT32 current);
+
+    // run ikcp_update on every session due up to 'current', returns how many ran
+    int Update(IUINT32 current);
+
+    // milliseconds until the next due session, at most 'maxWait'
+    int Timeout(IUINT32 current, int maxWait) const;
+
+    size_t Size() const;
+
+    // cpu per idle session of the wheel against updating all sessions every 1ms
+    static void Benchmark(int seconds = 10);
+
+private:
+    struct Node {
+        ikcpcb *kcp;
+        IUINT32 expire;
+        Node *prev;
+        Node *next;
+    };
+
+    static constexpr int ROOT_BITS = 8;
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr int LEVELS = 4;
+    static constexpr IUINT32 ROOT_SIZE = 1 << ROOT_BITS;
+    static constexpr IUINT32 LEVEL_SIZE = 1 << LEVEL_BITS;
+
+    void Insert(Node *node);
+
+    void Unlink(Node *node);
+
+    void Cascade(int level);
+
+    Node m_root[ROOT_SIZE];
+    Node m_levels[LEVELS - 1][LEVEL_SIZE];
+    // next tick to be processed
+    IUINT32 m_current;
+    std::unordered_map<ikcpcb *, Node *> m_nodes;
+};
+
+#endif //DEVIDROID_KCPSCHEDULER_H
@@ -0,0 +1,100 @@
+#include "KcpSweep.h"
+#include <cstdio>
+#include <ctime>
+
+#ifndef LOG_TAG
+#define LOG_TAG "KcpSweep"
+#endif
+
+#include <Utils/logging.h>
+
+std::vector<KcpLink> KcpSweepSpec::DefaultLinks()
+{
+    std::vector<KcpLink> links(3);
+    // same as KcpEmulator's default: 10% round trip loss, 60~125ms rtt
+    links[0].name = "uniform";
+    links[1].name = "burst";
+    links[1].impairment.jitter = JITTER_PARETO;
+    links[1].impairment.geGood2Bad = 2;
+    links[1].impairment.geBad2Good = 25;
+    links[1].impairment.geLossGood = 1;
+    links[1].impairment.geLossBad = 50;
+    links[1].impairment.reorder = 2;
+    links[1].impairment.reorderms = 20;
+    links[2].name = "capped";
+    links[2].impairment.jitter = JITTER_NORMAL;
+    links[2].impairment.bandwidth = 64 * 1024;
+    links[2].impairment.queuems = 200;
+    links[2].impairment.duplicate = 1;
+    return links;
+}
+
+int KcpSweep(const KcpSweepSpec &spec, const std::string &csvPath, const std::string &jsonPath)
+{
+    FILE *csv = csvPath.empty() ? nullptr : fopen(csvPath.c_str(), "w");
+    FILE *json = jsonPath.empty() ? nullptr : fopen(jsonPath.c_str(), "w");
+    if ((!csvPath.empty() && csv == nullptr) || (!jsonPath.empty() && json == nullptr)) {
+        LOGE("open sweep output '%s' / '%s' fail.", csvPath.c_str(), jsonPath.c_str());
+        if (csv != nullptr) fclose(csv);
+        if (json != nullptr) fclose(json);
+        return -1;
+    }
+    if (csv != nullptr) {
+        fprintf(csv, "link,seed,nodelay,interval,resend,nc,wnd,mtu,count,p50,p90,p99,max,avg,"
+                     "goodput,retrans,overhead,elapsed\n");
+    }
+    if (json != nullptr) {
+        fprintf(json, "[\n");
+    }
+
+    int runs = 0;
+    std::clock_t start = std::clock();
+    for (const KcpLink &link : spec.links)
+    for (unsigned int seed : spec.seeds)
+    for (int nodelay : spec.nodelay)
+    for (int interval : spec.interval)
+    for (int resend : spec.resend)
+    for (int nc : spec.nc)
+    for (int wnd : spec.wnd)
+    for (int mtu : spec.mtu) {
+        KcpConfig config;
+        config.nodelay = nodelay;
+        config.interval = interval;
+        config.resend = resend;
+        config.nc = nc;
+        config.wnd = wnd;
+        config.mtu = mtu;
+        config.size = spec.size;
+        config.period = spec.period;
+        KcpEmulator emulator;
+        emulator.SetImpairment(link.impairment);
+        KcpStat stat = emulator.KcpSimulate(config, seed, spec.packets);
+        int avg = stat.count > 0 ? (int) (stat.sumrtt / stat.count) : -1;
+        if (csv != nullptr) {
+            fprintf(csv, "%s,%u,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.1f,%.4f,%.3f,%u\n",
+                    link.name.c_str(), seed, nodelay, interval, resend, nc, wnd, mtu,
+                    stat.count, stat.p50, stat.p90, stat.p99, stat.maxrtt, avg,
+                    stat.goodput, stat.retrans, stat.overhead, stat.elapsed);
+        }
+        if (json != nullptr) {
+            fprintf(json, "%s  {\"link\": \"%s\", \"seed\": %u, \"nodelay\": %d, \"interval\": %d, "
+                          "\"resend\": %d, \"nc\": %d, \"wnd\": %d, \"mtu\": %d, \"count\": %d, "
+                          "\"p50\": %d, \"p90\": %d, \"p99\": %d, \"max\": %d, \"avg\": %d, "
+                          "\"goodput\": %.1f, \"retrans\": %.4f, \"overhead\": %.3f, \"elapsed\": %u}",
+                    runs > 0 ? ",\n" : "", link.name.c_str(), seed, nodelay, interval, resend, nc,
+                    wnd, mtu, stat.count, stat.p50, stat.p90, stat.p99, stat.maxrtt, avg,
+                    stat.goodput, stat.retrans, stat.overhead, stat.elapsed);
+        }
+        runs++;
+    }
+
+    if (json != nullptr) {
+        fprintf(json, "\n]\n");
+        fclose(json);
+    }
+    if (csv != nullptr) {
+        fclose(csv);
+    }
+    LOGI("kcp sweep: %d runs in %.0fms cpu.", runs, (std::clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    return runs;
+}
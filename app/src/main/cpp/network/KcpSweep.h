@@ -0,0 +1,35 @@
+#ifndef DEVIDROID_KCPSWEEP_H
+#define DEVIDROID_KCPSWEEP_H
+
+#include <string>
+#include <vector>
+#include "KcpEmulator.h"
+
+// named impairment setting of a sweep
+struct KcpLink {
+    std::string name;
+    KcpImpairment impairment;
+};
+
+// every combination of the lists is simulated once per seed
+struct KcpSweepSpec {
+    std::vector<int> nodelay = {0, 1, 2};
+    std::vector<int> interval = {10, 20};
+    std::vector<int> resend = {0, 2};
+    std::vector<int> nc = {0, 1};
+    std::vector<int> wnd = {32, 128, 1024};
+    std::vector<int> mtu = {512, 1400};
+    std::vector<KcpLink> links = DefaultLinks();
+    std::vector<unsigned int> seeds = {1};
+    int packets = 1000;
+    int size = 8;
+    int period = 20;
+
+    static std::vector<KcpLink> DefaultLinks();
+};
+
+// simulate the grid on KcpEmulator's virtual clock, write one row per run to csv and json;
+// an empty path skips that output, returns the number of runs
+int KcpSweep(const KcpSweepSpec &spec, const std::string &csvPath, const std::string &jsonPath);
+
+#endif //DEVIDROID_KCPSWEEP_H
@@ -0,0 +1,365 @@
+#include "KcpTransport.h"
+#include "KcpEmulator.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifndef LOG_TAG
+#define LOG_TAG "KcpTransport"
+#endif
+
+#include <Utils/logging.h>
+
+namespace {
+    // bionic only declares sendmmsg from API 21
+    inline int SendMmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags)
+    {
+#if defined(__ANDROID_API__) && __ANDROID_API__ < 21
+        return static_cast<int>(syscall(__NR_sendmmsg, sock, msgs, vlen, flags));
+#else
+        return sendmmsg(sock, msgs, vlen, flags);
+#endif
+    }
+
+    constexpr int MAX_WAIT_MS = 100;
+    constexpr int PACKET_SIZE = 65536;
+    constexpr unsigned short BENCH_PORT = 8901;
+
+    struct BenchStat {
+        std::atomic<int> echoed{0};
+        std::atomic<long long> bytes{0};
+        std::atomic<long long> sumRtt{0};
+        std::atomic<long long> maxRtt{0};
+    } g_bench;
+
+    long long MicroNow()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // peer side: small messages are pings and go back, bigger ones are counted
+    void BenchEcho(const char *data, int size, void *user)
+    {
+        if (size == sizeof(long long)) {
+            static_cast<KcpTransport *>(user)->Send(data, size);
+        } else {
+            g_bench.bytes += size;
+        }
+    }
+
+    void BenchPong(const char *data, int size, void *)
+    {
+        long long sent;
+        memcpy(&sent, data, sizeof(sent));
+        long long rtt = MicroNow() - sent;
+        g_bench.sumRtt += rtt;
+        if (rtt > g_bench.maxRtt) {
+            g_bench.maxRtt = rtt;
+        }
+        g_bench.echoed++;
+    }
+}
+
+KcpTransport::KcpTransport(IUINT32 conv, int mode, int wnd, int batch) :
+        m_recvBuf(PACKET_SIZE)
+{
+    m_kcp = ikcp_create(conv, this);
+    ikcp_setoutput(m_kcp, Output);
+    if (batch > 0 && ikcp_setoutputv(m_kcp, OutputBatch, batch) == 0) {
+        // connected socket, no msg_name; one iovec per datagram
+        m_iovs.resize(batch);
+        m_msgs.resize(batch);
+        for (int i = 0; i < batch; i++) {
+            memset(&m_msgs[i], 0, sizeof(struct mmsghdr));
+            m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+            m_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+    ikcp_wndsize(m_kcp, wnd, wnd);
+    if (mode == 0) {
+        ikcp_nodelay(m_kcp, 0, 10, 0, 0);
+    } else if (mode == 1) {
+        ikcp_nodelay(m_kcp, 0, 10, 0, 1);
+    } else {
+        ikcp_nodelay(m_kcp, 2, 10, 2, 1);
+        m_kcp->rx_minrto = 10;
+        m_kcp->fastresend = 1;
+    }
+}
+
+KcpTransport::~KcpTransport()
+{
+    if (m_socket >= 0) {
+        close(m_socket);
+    }
+    ikcp_release(m_kcp);
+}
+
+int KcpTransport::Open(unsigned short localPort, const std::string &peerIp, unsigned short peerPort)
+{
+    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_socket < 0) {
+        LOGE("socket: %s", strerror(errno));
+        return -1;
+    }
+    int flags = fcntl(m_socket, F_GETFL, 0);
+    fcntl(m_socket, F_SETFL, flags | O_NONBLOCK);
+    int opt = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const void *) &opt, sizeof(opt));
+
+    struct sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(localPort);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(m_socket, (struct sockaddr *) &local, sizeof(local)) < 0) {
+        LOGE("bind %d: %s", localPort, strerror(errno));
+        close(m_socket);
+        m_socket = -1;
+        return -2;
+    }
+    // connected udp, so output is a plain send and other senders are filtered out
+    struct sockaddr_in peer{};
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(peerPort);
+    peer.sin_addr.s_addr = inet_addr(peerIp.c_str());
+    if (connect(m_socket, (struct sockaddr *) &peer, sizeof(peer)) < 0) {
+        LOGE("connect %s:%d: %s", peerIp.c_str(), peerPort, strerror(errno));
+        close(m_socket);
+        m_socket = -1;
+        return -3;
+    }
+    LOGI("kcp conv %x on [%d] -> [%s:%d].", m_kcp->conv, localPort, peerIp.c_str(), peerPort);
+    // armed here, not in Run: a Finish that comes before the run thread starts must stick
+    m_running = true;
+    return m_socket;
+}
+
+void KcpTransport::RegisterCallback(KCPHOOK hook, void *user)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_hook = hook;
+    m_user = user;
+}
+
+void KcpTransport::EnableFec(unsigned int data, unsigned int parity)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (data == 0) {
+        m_fecEncoder.reset();
+        m_fecDecoder.reset();
+        return;
+    }
+    m_fecEncoder.reset(new FecEncoder(data, parity, FecOutput, this));
+    m_fecDecoder.reset(new FecDecoder(FecInput, this));
+    // every datagram has to pass the encoder one by one
+    ikcp_setoutputv(m_kcp, nullptr, 0);
+}
+
+void KcpTransport::FecOutput(const char *data, size_t size, void *user)
+{
+    ::send(static_cast<KcpTransport *>(user)->m_socket, data, size, 0);
+}
+
+void KcpTransport::FecInput(const char *data, size_t size, void *user)
+{
+    ikcp_input(static_cast<KcpTransport *>(user)->m_kcp, data, static_cast<long>(size));
+}
+
+int KcpTransport::Output(const char *buf, int len, ikcpcb *, void *user)
+{
+    auto *transport = static_cast<KcpTransport *>(user);
+    if (transport->m_fecEncoder != nullptr) {
+        return transport->m_fecEncoder->Encode(buf, static_cast<size_t>(len));
+    }
+    // a full socket buffer is a lost packet, kcp resends it
+    ssize_t res = ::send(transport->m_socket, buf, static_cast<size_t>(len), 0);
+    return res < 0 ? -1 : 0;
+}
+
+int KcpTransport::OutputBatch(const char **bufs, const int *lens, int count, ikcpcb *, void *user)
+{
+    auto *transport = static_cast<KcpTransport *>(user);
+    for (int i = 0; i < count; i++) {
+        transport->m_iovs[i].iov_base = const_cast<char *>(bufs[i]);
+        transport->m_iovs[i].iov_len = static_cast<size_t>(lens[i]);
+    }
+    int sent = 0;
+    while (sent < count) {
+        int num = SendMmsg(transport->m_socket, &transport->m_msgs[sent],
+                           static_cast<unsigned int>(count - sent), 0);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // like Output, what the socket refused counts as lost
+            break;
+        }
+        sent += num;
+    }
+    return sent < count ? -1 : 0;
+}
+
+int KcpTransport::Send(const char *data, int size)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    int ret = ikcp_send(m_kcp, data, size);
+    if (ret >= 0) {
+        ikcp_flush(m_kcp);
+    }
+    return ret;
+}
+
+int KcpTransport::Recv(char *buffer, int size)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return ikcp_recv(m_kcp, buffer, size);
+}
+
+void KcpTransport::Deliver()
+{
+    std::vector<char> message;
+    while (true) {
+        KCPHOOK hook;
+        void *user;
+        int size;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            hook = m_hook;
+            user = m_user;
+            // without a hook the messages stay queued for Recv
+            if (hook == nullptr) {
+                return;
+            }
+            size = ikcp_peeksize(m_kcp);
+            if (size < 0) {
+                return;
+            }
+            if (message.size() < (size_t) size) {
+                message.resize(size);
+            }
+            size = ikcp_recv(m_kcp, message.data(), size);
+        }
+        if (size < 0) {
+            return;
+        }
+        hook(message.data(), size, user);
+    }
+}
+
+int KcpTransport::Run()
+{
+    if (m_socket < 0) {
+        LOGE("kcp transport is not open.");
+        return -1;
+    }
+    while (m_running) {
+        IUINT32 current = iclock();
+        IUINT32 next;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            next = ikcp_check(m_kcp, current);
+        }
+        int wait = static_cast<int>(next - current);
+        wait = wait < 0 ? 0 : (wait > MAX_WAIT_MS ? MAX_WAIT_MS : wait);
+        struct pollfd pfd = {m_socket, POLLIN, 0};
+        int res = poll(&pfd, 1, wait);
+        if (res < 0 && errno != EINTR) {
+            LOGE("poll: %s", strerror(errno));
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            while (res > 0) {
+                ssize_t size = ::recv(m_socket, m_recvBuf.data(), m_recvBuf.size(), 0);
+                if (size < 0) {
+                    break;
+                }
+                if (m_fecDecoder != nullptr) {
+                    m_fecDecoder->Input(m_recvBuf.data(), static_cast<size_t>(size));
+                } else {
+                    ikcp_input(m_kcp, m_recvBuf.data(), size);
+                }
+            }
+            ikcp_update(m_kcp, iclock());
+        }
+        Deliver();
+    }
+    return 0;
+}
+
+void KcpTransport::Finish()
+{
+    m_running = false;
+}
+
+int KcpTransport::Benchmark(int count, int mode)
+{
+    const IUINT32 conv = 0x11223344;
+    KcpTransport local(conv, mode);
+    KcpTransport remote(conv, mode);
+    if (local.Open(BENCH_PORT, "127.0.0.1", BENCH_PORT + 1) < 0
+        || remote.Open(BENCH_PORT + 1, "127.0.0.1", BENCH_PORT) < 0) {
+        return -1;
+    }
+    g_bench.echoed = 0;
+    g_bench.bytes = 0;
+    g_bench.sumRtt = 0;
+    g_bench.maxRtt = 0;
+    local.RegisterCallback(BenchPong);
+    remote.RegisterCallback(BenchEcho, &remote);
+    std::thread th1(&KcpTransport::Run, &local);
+    std::thread th2(&KcpTransport::Run, &remote);
+
+    // latency: one ping in flight at a time
+    for (int i = 0; i < count; i++) {
+        long long now = MicroNow();
+        local.Send(reinterpret_cast<const char *>(&now), sizeof(now));
+        while (g_bench.echoed <= i && MicroNow() - now < 1000000) {
+            usleep(50);
+        }
+    }
+    int echoed = g_bench.echoed;
+
+    // throughput: 1KB messages while the send window has room
+    char block[1024];
+    memset(block, 0x6b, sizeof(block));
+    long long start = MicroNow();
+    for (int i = 0; i < count; i++) {
+        while (true) {
+            int waiting;
+            {
+                std::lock_guard<std::mutex> lock(local.m_lock);
+                waiting = ikcp_waitsnd(local.m_kcp);
+            }
+            if (waiting < 256) {
+                break;
+            }
+            usleep(100);
+        }
+        local.Send(block, sizeof(block));
+    }
+    long long expect = (long long) count * sizeof(block);
+    while (g_bench.bytes < expect && MicroNow() - start < 10000000) {
+        usleep(100);
+    }
+    long long elapsed = MicroNow() - start;
+
+    local.Finish();
+    remote.Finish();
+    th1.join();
+    th2.join();
+    LOGI("kcp mode %d rtt: %d/%d echoed, avg = %lldus, max = %lldus.", mode, echoed, count,
+         echoed > 0 ? g_bench.sumRtt / echoed : 0, g_bench.maxRtt.load());
+    LOGI("kcp mode %d throughput: %lld/%lld bytes in %lldus, %.2f MB/s.", mode,
+         g_bench.bytes.load(), expect, elapsed,
+         elapsed > 0 ? g_bench.bytes * 1.0 / elapsed : 0);
+    return echoed;
+}
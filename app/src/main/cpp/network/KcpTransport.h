@@ -0,0 +1,72 @@
+#ifndef DEVIDROID_KCPTRANSPORT_H
+#define DEVIDROID_KCPTRANSPORT_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "kcp/ikcp.h"
+#include "FecCodec.h"
+
+// one received kcp message, data is only valid inside the hook
+typedef void(*KCPHOOK)(const char *data, int size, void *user);
+
+// kcp session over a real non-blocking udp socket, driven by Run
+class KcpTransport {
+public:
+    // mode: 0 default, 1 normal, 2 fast, same presets as KcpEmulator::KcpRun;
+    // batch > 0 sends the datagrams of one flush with a single sendmmsg, 0 one send each
+    explicit KcpTransport(IUINT32 conv, int mode = 2, int wnd = 128, int batch = 32);
+
+    virtual ~KcpTransport();
+
+    int Open(unsigned short localPort, const std::string &peerIp, unsigned short peerPort);
+
+    void RegisterCallback(KCPHOOK hook, void *user = nullptr);
+
+    // reed-solomon groups of 'data' + 'parity' under kcp, both ends must agree; call before Run.
+    // parity goes out when a group is full, the tail of a burst is left to kcp's resend
+    void EnableFec(unsigned int data, unsigned int parity);
+
+    // thread safe, flushed right away for low latency
+    int Send(const char *data, int size);
+
+    // non-blocking, for use without a hook
+    int Recv(char *buffer, int size);
+
+    // poll the socket and ikcp_update at ikcp_check deadlines until Finish
+    int Run();
+
+    void Finish();
+
+    // echo 'count' messages between two loopback transports, reports rtt and throughput
+    static int Benchmark(int count = 1000, int mode = 2);
+
+private:
+    static int Output(const char *buf, int len, ikcpcb *kcp, void *user);
+
+    static int OutputBatch(const char **bufs, const int *lens, int count, ikcpcb *kcp, void *user);
+
+    static void FecOutput(const char *data, size_t size, void *user);
+
+    static void FecInput(const char *data, size_t size, void *user);
+
+    void Deliver();
+
+    ikcpcb *m_kcp = nullptr;
+    int m_socket = -1;
+    std::mutex m_lock;
+    KCPHOOK m_hook = nullptr;
+    void *m_user = nullptr;
+    std::vector<char> m_recvBuf;
+    std::vector<struct iovec> m_iovs;
+    std::vector<struct mmsghdr> m_msgs;
+    std::unique_ptr<FecEncoder> m_fecEncoder;
+    std::unique_ptr<FecDecoder> m_fecDecoder;
+    std::atomic<bool> m_running{false};
+};
+
+#endif //DEVIDROID_KCPTRANSPORT_H
@@ -0,0 +1,192 @@
+#include "TcpFrame.h"
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <sys/uio.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG "TcpFrame"
+#endif
+
+#include <Utils/logging.h>
+
+namespace {
+    // buffers of large messages are recycled between connections
+    class FramePool {
+    public:
+        static FramePool &instance()
+        {
+            static FramePool pool;
+            return pool;
+        }
+
+        void Acquire(std::vector<uint8_t> &buffer, size_t size)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                for (size_t i = 0; i < m_free.size(); i++) {
+                    if (m_free[i].capacity() >= size) {
+                        buffer.swap(m_free[i]);
+                        m_free[i].swap(m_free.back());
+                        m_free.pop_back();
+                        break;
+                    }
+                }
+            }
+            buffer.resize(size);
+        }
+
+        void Release(std::vector<uint8_t> &buffer)
+        {
+            std::vector<uint8_t> keep;
+            keep.swap(buffer);
+            if (keep.capacity() > MAX_KEEP_SIZE) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_free.size() < MAX_KEEP_COUNT) {
+                m_free.push_back(std::move(keep));
+            }
+        }
+
+    private:
+        static constexpr size_t MAX_KEEP_COUNT = 16;
+        static constexpr size_t MAX_KEEP_SIZE = 4 << 20;
+        std::mutex m_lock;
+        std::vector<std::vector<uint8_t>> m_free;
+    };
+}
+
+TcpFrame::~TcpFrame()
+{
+    if (m_body.capacity() > 0) {
+        FramePool::instance().Release(m_body);
+    }
+}
+
+void TcpFrame::EncodeHeader(uint8_t *header, uint16_t type, uint32_t length)
+{
+    header[0] = static_cast<uint8_t>(length >> 24);
+    header[1] = static_cast<uint8_t>(length >> 16);
+    header[2] = static_cast<uint8_t>(length >> 8);
+    header[3] = static_cast<uint8_t>(length);
+    header[4] = static_cast<uint8_t>(type >> 8);
+    header[5] = static_cast<uint8_t>(type);
+    header[6] = 0;
+    header[7] = 0;
+}
+
+ssize_t TcpFrame::Send(int sock, uint16_t type, const void *data, size_t size)
+{
+    if (size > FRAME_MAX_LEN) {
+        LOGE("frame of %zu bytes over limit %u.", size, FRAME_MAX_LEN);
+        return -1;
+    }
+    uint8_t header[FRAME_HEADER_LEN];
+    EncodeHeader(header, type, static_cast<uint32_t>(size));
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAME_HEADER_LEN;
+    iov[1].iov_base = const_cast<void *>(data);
+    iov[1].iov_len = size;
+    size_t total = FRAME_HEADER_LEN + size;
+    size_t sent = 0;
+    int index = 0;
+    while (sent < total) {
+        ssize_t res = ::writev(sock, iov + index, 2 - index);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("writev frame (%s).", strerror(errno));
+            return -1;
+        }
+        sent += res;
+        // skip what the kernel already took
+        while (index < 2 && static_cast<size_t>(res) >= iov[index].iov_len) {
+            res -= iov[index].iov_len;
+            index++;
+        }
+        if (index < 2) {
+            iov[index].iov_base = static_cast<uint8_t *>(iov[index].iov_base) + res;
+            iov[index].iov_len -= res;
+        }
+    }
+    return static_cast<ssize_t>(sent);
+}
+
+int TcpFrame::Begin(const uint8_t *header)
+{
+    m_length = (uint32_t) header[0] << 24 | (uint32_t) header[1] << 16
+               | (uint32_t) header[2] << 8 | header[3];
+    m_type = static_cast<uint16_t>(header[4] << 8 | header[5]);
+    if (m_length > FRAME_MAX_LEN) {
+        LOGE("frame type %u length %u over limit %u.", m_type, m_length, FRAME_MAX_LEN);
+        return -1;
+    }
+    return 0;
+}
+
+int TcpFrame::Feed(const uint8_t *data, size_t size, FRAMEHOOK hook, void *user)
+{
+    int count = 0;
+    while (size > 0) {
+        if (m_inBody) {
+            size_t need = m_length - m_bodyLen;
+            size_t take = size < need ? size : need;
+            memcpy(m_body.data() + m_bodyLen, data, take);
+            m_bodyLen += take;
+            data += take;
+            size -= take;
+            if (m_bodyLen < m_length) {
+                break;
+            }
+            m_inBody = false;
+            int res = hook != nullptr ? hook(m_type, m_body.data(), m_length, user) : 0;
+            FramePool::instance().Release(m_body);
+            if (res < 0) {
+                return -2;
+            }
+            count++;
+            continue;
+        }
+        if (m_headerLen == 0 && size >= FRAME_HEADER_LEN) {
+            if (Begin(data) < 0) {
+                return -1;
+            }
+            data += FRAME_HEADER_LEN;
+            size -= FRAME_HEADER_LEN;
+        } else {
+            size_t take = FRAME_HEADER_LEN - m_headerLen;
+            take = size < take ? size : take;
+            memcpy(m_header + m_headerLen, data, take);
+            m_headerLen += take;
+            data += take;
+            size -= take;
+            if (m_headerLen < FRAME_HEADER_LEN) {
+                break;
+            }
+            m_headerLen = 0;
+            if (Begin(m_header) < 0) {
+                return -1;
+            }
+        }
+        if (size >= m_length) {
+            int res = hook != nullptr ? hook(m_type, data, m_length, user) : 0;
+            if (res < 0) {
+                return -2;
+            }
+            data += m_length;
+            size -= m_length;
+            count++;
+        } else {
+            FramePool::instance().Acquire(m_body, m_length);
+            memcpy(m_body.data(), data, size);
+            m_bodyLen = size;
+            m_inBody = true;
+            size = 0;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,47 @@
+#ifndef DEVIDROID_TCPFRAME_H
+#define DEVIDROID_TCPFRAME_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+// wire header: 4 bytes length, 2 bytes type, 2 bytes flags, all big endian
+constexpr const size_t FRAME_HEADER_LEN = 8;
+constexpr const uint32_t FRAME_MAX_LEN = 16 << 20;
+
+// one complete message, data is only valid inside the hook; a negative return closes the peer
+typedef int(*FRAMEHOOK)(uint16_t type, const uint8_t *data, size_t size, void *user);
+
+// incremental length-prefixed parser, one per connection
+class TcpFrame {
+public:
+    TcpFrame() = default;
+
+    ~TcpFrame();
+
+    TcpFrame(const TcpFrame &) = delete;
+
+    TcpFrame &operator=(const TcpFrame &) = delete;
+
+    // messages complete inside 'data' are handed out in place, split ones are assembled in a pooled buffer
+    int Feed(const uint8_t *data, size_t size, FRAMEHOOK hook, void *user);
+
+    static void EncodeHeader(uint8_t *header, uint16_t type, uint32_t length);
+
+    // header and payload in one writev, no copy of the payload
+    static ssize_t Send(int sock, uint16_t type, const void *data, size_t size);
+
+private:
+    int Begin(const uint8_t *header);
+
+    uint8_t m_header[FRAME_HEADER_LEN]{};
+    size_t m_headerLen = 0;
+    uint16_t m_type = 0;
+    uint32_t m_length = 0;
+    bool m_inBody = false;
+    size_t m_bodyLen = 0;
+    std::vector<uint8_t> m_body;
+};
+
+#endif //DEVIDROID_TCPFRAME_H
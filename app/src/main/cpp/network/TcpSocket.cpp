@@ -9,6 +9,12 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 
 #ifndef LOG_TAG
 #define LOG_TAG "TcpSocket"
@@ -17,9 +23,32 @@
 #include <Utils/logging.h>
 #include <cerrno>
 
-int TcpSocket::Reciever(SOCKETHOOK callback) const
+namespace {
+    constexpr int MAX_EVENTS = 256;
+    constexpr int LOOP_TIMEOUT_MS = 500;
+
+    int SetNonBlock(int sock)
+    {
+        int flags = fcntl(sock, F_GETFL, 0);
+        if (flags < 0) {
+            return -1;
+        }
+        return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    std::atomic<uint64_t> g_benchBytes{0};
+    std::atomic<uint64_t> g_benchFrames{0};
+
+    int BenchHook(uint16_t, const uint8_t *, size_t size, void *)
+    {
+        g_benchBytes += size;
+        g_benchFrames++;
+        return 0;
+    }
+}
+
+int TcpSocket::Reciever(int sock, SOCKETHOOK callback) const
 {
-    int sock = this->GetSocket();
     size_t size = this->GetSize();
     uint8_t data[size];
     ssize_t res = ::recv(sock, data, size, 0);
@@ -27,13 +56,16 @@ int TcpSocket::Reciever(SOCKETHOOK callback) const
         close(sock);
         return -2;
     }
+    if (res < 0) {
+        return 0;
+    }
     if (callback != nullptr) {
-        return callback(data, size);
+        return callback(data, static_cast<size_t>(res));
     }
     return -3;
 }
 
-int TcpSocket::Start(unsigned short port)
+int TcpSocket::Listen(unsigned short port, int backlog)
 {
     int init_sock = ::socket(AF_INET, SOCK_STREAM, 0);
     if (init_sock < 0) {
@@ -42,6 +74,8 @@ int TcpSocket::Start(unsigned short port)
         return -1;
     }
 
+    int opt = 1;
+    setsockopt(init_sock, SOL_SOCKET, SO_REUSEADDR, (const void *) &opt, sizeof(opt));
     struct sockaddr_in local{};
     local.sin_port = htons(port);
     local.sin_family = AF_INET;
@@ -53,19 +87,27 @@ int TcpSocket::Start(unsigned short port)
         return -2;
     }
 
-    const int backlog = 50;
     if (listen(init_sock, backlog) < 0) {
         LOGE("Socket listen (%s).",
              (errno != 0 ? strerror(errno) : std::to_string(init_sock).c_str()));
         close(init_sock);
         return -3;
     }
+    return init_sock;
+}
+
+int TcpSocket::Start(unsigned short port)
+{
+    const int backlog = 50;
+    int init_sock = Listen(port, backlog);
+    if (init_sock < 0) {
+        return init_sock;
+    }
 
     struct sockaddr_in lstnaddr{};
     auto listenLen = static_cast<socklen_t>(sizeof(lstnaddr));
     getsockname(init_sock, reinterpret_cast<struct sockaddr *>(&lstnaddr), &listenLen);
     LOGI("localhost listening [%s:%d].", inet_ntoa(lstnaddr.sin_addr), port);
-    m_running = true;
 
     while (m_running) {
         struct sockaddr_in sin{};
@@ -101,7 +143,10 @@ int TcpSocket::Start(unsigned short port)
                     [=](TcpSocket *clazz) -> int {
                         int ret = 0;
                         while (m_running) {
-                            ret = Reciever(m_callback);
+                            ret = Reciever(rcv_sock, m_callback);
+                            if (ret == -2) {
+                                break;
+                            }
                         }
                         return ret;
                     }, this);
@@ -114,11 +159,237 @@ int TcpSocket::Start(unsigned short port)
     return 0;
 }
 
+int TcpSocket::StartReactor(unsigned short port, unsigned int threads)
+{
+    int listenSock = Listen(port, SOMAXCONN);
+    if (listenSock < 0) {
+        return listenSock;
+    }
+    SetNonBlock(listenSock);
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    std::vector<int> loops;
+    for (unsigned int i = 0; i < threads; i++) {
+        int epfd = epoll_create(MAX_EVENTS);
+        if (epfd < 0) {
+            LOGE("epoll_create (%s).", strerror(errno));
+            for (int fd : loops) {
+                close(fd);
+            }
+            close(listenSock);
+            return -5;
+        }
+        loops.push_back(epfd);
+    }
+    // only the first loop accepts, new peers are spread over all loops
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(loops[0], EPOLL_CTL_ADD, listenSock, &event);
+    LOGI("localhost reactor listening [%d] with %u loops.", port, threads);
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++) {
+        workers.emplace_back(&TcpSocket::EventLoop, this, loops[i], -1, std::cref(loops));
+    }
+    EventLoop(loops[0], listenSock, loops);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (TcpConnection *conn : m_connections) {
+        close(conn->sock);
+        delete conn;
+    }
+    m_connections.clear();
+    for (int fd : loops) {
+        close(fd);
+    }
+    close(listenSock);
+    return 0;
+}
+
+void TcpSocket::EventLoop(int epfd, int listenSock, const std::vector<int> &loops)
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (m_running) {
+        int num = epoll_wait(epfd, events, MAX_EVENTS, LOOP_TIMEOUT_MS);
+        if (num < 0 && errno != EINTR) {
+            LOGE("epoll_wait (%s).", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < num; i++) {
+            auto *conn = static_cast<TcpConnection *>(events[i].data.ptr);
+            if (conn == nullptr) {
+                Accept(listenSock, loops);
+                continue;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                && ReadConnection(conn) < 0) {
+                CloseConnection(epfd, conn);
+            }
+        }
+    }
+}
+
+void TcpSocket::Accept(int listenSock, const std::vector<int> &loops)
+{
+    while (true) {
+        struct sockaddr_in sin{};
+        auto len = static_cast<socklen_t>(sizeof(sin));
+        int sock = ::accept(listenSock, reinterpret_cast<struct sockaddr *>(&sin), &len);
+        if (sock < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGE("Socket accept (%s).", strerror(errno));
+            }
+            return;
+        }
+        SetNonBlock(sock);
+        auto *conn = new TcpConnection;
+        conn->sock = sock;
+        conn->peer = sin;
+        conn->buffer.resize(m_recvSize);
+        {
+            std::lock_guard<std::mutex> lock(m_connLock);
+            m_connections.insert(conn);
+        }
+        struct epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        int epfd = loops[m_nextLoop++ % loops.size()];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &event) < 0) {
+            LOGE("epoll_ctl add peer(%d) (%s).", sock, strerror(errno));
+            CloseConnection(-1, conn);
+            continue;
+        }
+        LOGD("accepted peer(%d) address [%s:%d].", sock, inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
+    }
+}
+
+int TcpSocket::ReadConnection(TcpConnection *conn)
+{
+    // edge triggered, drain until the kernel buffer is empty
+    while (true) {
+        ssize_t res = ::recv(conn->sock, conn->buffer.data(), conn->buffer.size(), 0);
+        if (res > 0) {
+            if (m_frameHook != nullptr) {
+                if (conn->frame.Feed(conn->buffer.data(), static_cast<size_t>(res), m_frameHook, conn) < 0) {
+                    return -1;
+                }
+            } else if (m_callback != nullptr) {
+                m_callback(conn->buffer.data(), static_cast<size_t>(res));
+            }
+            continue;
+        }
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+void TcpSocket::CloseConnection(int epfd, TcpConnection *conn)
+{
+    if (epfd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sock, nullptr);
+    }
+    LOGD("close peer(%d).", conn->sock);
+    close(conn->sock);
+    {
+        std::lock_guard<std::mutex> lock(m_connLock);
+        m_connections.erase(conn);
+    }
+    delete conn;
+}
+
+int TcpSocket::Benchmark(unsigned short port, int clients, unsigned int threads)
+{
+    // every client costs two descriptors on loopback
+    struct rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    g_benchBytes = 0;
+    g_benchFrames = 0;
+    TcpSocket server;
+    server.RegisterFrameCallback(BenchHook);
+    std::thread th([&server, port, threads]() -> void {
+        server.StartReactor(port, threads);
+    });
+    usleep(100000);
+
+    struct sockaddr_in peer{};
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(port);
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> socks;
+    for (int i = 0; i < clients; i++) {
+        int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0 || ::connect(sock, reinterpret_cast<struct sockaddr *>(&peer), sizeof(peer)) < 0) {
+            LOGE("client %d connect (%s).", i, strerror(errno));
+            if (sock >= 0) {
+                close(sock);
+            }
+            break;
+        }
+        socks.push_back(sock);
+    }
+    auto connected = std::chrono::steady_clock::now();
+
+    // two frames per client: one whole, one cut inside its header so the parser has to carry it over
+    uint8_t payload[64];
+    memset(payload, 0x5a, sizeof(payload));
+    uint8_t split[FRAME_HEADER_LEN + sizeof(payload)];
+    TcpFrame::EncodeHeader(split, 1, sizeof(payload));
+    memcpy(split + FRAME_HEADER_LEN, payload, sizeof(payload));
+    for (int sock : socks) {
+        TcpFrame::Send(sock, 0, payload, sizeof(payload));
+        ::send(sock, split, FRAME_HEADER_LEN / 2, 0);
+    }
+    for (int sock : socks) {
+        ::send(sock, split + FRAME_HEADER_LEN / 2, sizeof(split) - FRAME_HEADER_LEN / 2, 0);
+    }
+    uint64_t expect = socks.size() * 2;
+    auto deadline = connected + std::chrono::seconds(5);
+    while (g_benchFrames < expect && std::chrono::steady_clock::now() < deadline) {
+        usleep(100);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (int sock : socks) {
+        close(sock);
+    }
+    server.Finish();
+    th.join();
+    LOGI("tcp reactor(%u loops): %zu/%d clients connected in %lldus, %llu/%llu frames (%llu bytes) received in %lldus.",
+         threads, socks.size(), clients,
+         (long long) std::chrono::duration_cast<std::chrono::microseconds>(connected - start).count(),
+         (unsigned long long) g_benchFrames.load(), (unsigned long long) expect,
+         (unsigned long long) g_benchBytes.load(),
+         (long long) std::chrono::duration_cast<std::chrono::microseconds>(end - connected).count());
+    return static_cast<int>(socks.size());
+}
+
 void TcpSocket::RegisterCallback(SOCKETHOOK callback)
 {
     m_callback = callback;
 }
 
+void TcpSocket::RegisterFrameCallback(FRAMEHOOK callback)
+{
+    m_frameHook = callback;
+}
+
 int TcpSocket::GetSocket() const
 {
     return m_recvSock;
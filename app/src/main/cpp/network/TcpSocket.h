@@ -5,32 +5,67 @@
 #ifndef DEVIDROID_TCPSOCKET_H
 #define DEVIDROID_TCPSOCKET_H
 
+#include <atomic>
 #include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include <unordered_set>
+#include <netinet/in.h>
+#include "TcpFrame.h"
 
 class TcpSocket;
 
 typedef int(*SOCKETHOOK)(uint8_t*, size_t);
 
+// state of one peer in reactor mode, only touched by the loop owning the socket
+struct TcpConnection {
+    int sock = -1;
+    struct sockaddr_in peer{};
+    std::vector<uint8_t> buffer;
+    TcpFrame frame;
+};
+
 class TcpSocket {
 public:
     TcpSocket() : m_recvSize(1024) {};
 
     void RegisterCallback(SOCKETHOOK);
 
+    // reactor peers speak TcpFrame, the hook gets one whole message and the TcpConnection as user
+    void RegisterFrameCallback(FRAMEHOOK);
+
     int Start(unsigned short port);
 
+    // non-blocking sockets on 'threads' edge-triggered epoll loops, blocks until Finish
+    int StartReactor(unsigned short port, unsigned int threads = 2);
+
     int GetSocket() const;
 
     int GetSize() const;
 
+    // stops Start/StartReactor, also when called before them; a finished socket does not start again
     void Finish();
 
+    // connect 'clients' loopback peers to a reactor and time two TcpFrame messages from each
+    static int Benchmark(unsigned short port, int clients = 1000, unsigned int threads = 2);
+
 private:
-    int Reciever(SOCKETHOOK callback) const;
+    int Listen(unsigned short port, int backlog);
+    int Reciever(int sock, SOCKETHOOK callback) const;
+    void EventLoop(int epfd, int listenSock, const std::vector<int> &loops);
+    void Accept(int listenSock, const std::vector<int> &loops);
+    int ReadConnection(TcpConnection *conn);
+    void CloseConnection(int epfd, TcpConnection *conn);
     const int m_recvSize;
     SOCKETHOOK m_callback = nullptr;
+    FRAMEHOOK m_frameHook = nullptr;
     int m_recvSock = 0;
-    volatile bool m_running = false;
+    // armed from construction, Start/StartReactor only read it: a Finish that comes before them sticks
+    std::atomic<bool> m_running{true};
+    unsigned int m_nextLoop = 0;
+    std::mutex m_connLock;
+    std::unordered_set<TcpConnection *> m_connections;
 };
 
 
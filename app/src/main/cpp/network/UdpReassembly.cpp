@@ -0,0 +1,167 @@
+#ifndef LOG_TAG
+#define LOG_TAG "UdpReassembly"
+#endif
+
+#include <Utils/logging.h>
+#include <cstring>
+
+#include "UdpReassembly.h"
+
+UdpReassembly::UdpReassembly(MESSAGEHOOK hook, void *user, unsigned int timeoutMs,
+                             size_t maxSize, size_t maxPending, size_t maxBytes) :
+        m_hook(hook),
+        m_user(user),
+        m_timeout(timeoutMs),
+        m_maxSize(maxSize),
+        m_maxPending(maxPending > 0 ? maxPending : 1),
+        m_maxBytes(maxBytes),
+        m_sweep(Clock::now())
+{
+}
+
+int UdpReassembly::Input(const NetProtocol &header, const char *payload, size_t length, uint64_t peer)
+{
+    Clock::time_point now = Clock::now();
+    if (now - m_sweep > m_timeout / 2) {
+        Expire();
+        m_sweep = now;
+    }
+    // not sliced, deliver straight from the receive slot
+    if (header.s_idx == 0 && header.offset == 0 && length >= header.size) {
+        if (m_hook != nullptr) {
+            m_hook(header.id, payload, length, m_user);
+        }
+        return 1;
+    }
+    if (header.size > m_maxSize || length == 0 || length != header.slice
+        || header.offset + length > header.size) {
+        LOGE("reject slice %llu of message %llu: size = %llu, offset = %llu, length = %zu.",
+             (unsigned long long) header.s_idx, (unsigned long long) header.id,
+             (unsigned long long) header.size, (unsigned long long) header.offset, length);
+        return -1;
+    }
+
+    Key key = {peer, header.id};
+    auto it = m_partials.find(key);
+    if (it == m_partials.end()) {
+        if (m_completed.count(key) > 0) {
+            return 0;
+        }
+        // slice length of the message, the last slice may be shorter
+        uint64_t unit = header.s_idx > 0 ? header.offset / header.s_idx : length;
+        if (unit == 0 || header.offset != header.s_idx * unit) {
+            return -2;
+        }
+        if (header.size > m_maxBytes) {
+            return -3;
+        }
+        if (m_partials.size() >= m_maxPending) {
+            EvictOldest();
+        }
+        while (!m_partials.empty() && m_bytes + header.size > m_maxBytes) {
+            EvictOldest();
+        }
+        Partial &partial = m_partials[key];
+        partial.unit = unit;
+        partial.slices = (header.size + unit - 1) / unit;
+        partial.buffer.resize(header.size);
+        m_bytes += header.size;
+        partial.bitmap.assign((partial.slices + 63) / 64, 0);
+        it = m_partials.find(key);
+    }
+    Partial &partial = it->second;
+    // every slice but the last is exactly one unit, the last one carries the rest:
+    // a short slice would leave a hole of stale bytes in a "complete" message
+    uint64_t expect = header.s_idx + 1 < partial.slices ? partial.unit
+                                                        : partial.buffer.size() - header.s_idx * partial.unit;
+    if (header.size != partial.buffer.size() || header.s_idx >= partial.slices
+        || header.offset != header.s_idx * partial.unit || length != expect) {
+        return -2;
+    }
+    partial.last = now;
+    uint64_t &word = partial.bitmap[header.s_idx / 64];
+    uint64_t bit = 1ULL << (header.s_idx % 64);
+    if (word & bit) {
+        return 0;
+    }
+    word |= bit;
+    memcpy(partial.buffer.data() + header.offset, payload, length);
+    if (++partial.received < partial.slices) {
+        return 0;
+    }
+    if (m_hook != nullptr) {
+        m_hook(header.id, partial.buffer.data(), partial.buffer.size(), m_user);
+    }
+    m_bytes -= partial.buffer.size();
+    m_partials.erase(it);
+    m_completed[key] = now;
+    return 1;
+}
+
+void UdpReassembly::BatchHook(const UdpRecord *records, size_t count, void *user)
+{
+    auto *reassembly = static_cast<UdpReassembly *>(user);
+    for (size_t i = 0; i < count; i++) {
+        const UdpRecord &record = records[i];
+        uint64_t peer = (uint64_t) record.remote.sin_addr.s_addr << 16 | record.remote.sin_port;
+        reassembly->Input(*record.header, record.payload, record.length, peer);
+    }
+}
+
+size_t UdpReassembly::Expire()
+{
+    size_t count = 0;
+    Clock::time_point now = Clock::now();
+    for (auto it = m_partials.begin(); it != m_partials.end();) {
+        if (now - it->second.last > m_timeout) {
+            LOGI("expire message %llu, %llu/%llu slices.", (unsigned long long) it->first.id,
+                 (unsigned long long) it->second.received, (unsigned long long) it->second.slices);
+            m_bytes -= it->second.buffer.size();
+            it = m_partials.erase(it);
+            count++;
+        } else {
+            it++;
+        }
+    }
+    for (auto it = m_completed.begin(); it != m_completed.end();) {
+        if (now - it->second > m_timeout) {
+            it = m_completed.erase(it);
+        } else {
+            it++;
+        }
+    }
+    m_dropped += count;
+    return count;
+}
+
+void UdpReassembly::EvictOldest()
+{
+    auto oldest = m_partials.begin();
+    for (auto it = m_partials.begin(); it != m_partials.end(); it++) {
+        if (it->second.last < oldest->second.last) {
+            oldest = it;
+        }
+    }
+    if (oldest != m_partials.end()) {
+        LOGI("evict message %llu for pending limits %zu messages, %zu bytes.",
+             (unsigned long long) oldest->first.id, m_maxPending, m_maxBytes);
+        m_bytes -= oldest->second.buffer.size();
+        m_partials.erase(oldest);
+        m_dropped++;
+    }
+}
+
+size_t UdpReassembly::Pending() const
+{
+    return m_partials.size();
+}
+
+size_t UdpReassembly::Buffered() const
+{
+    return m_bytes;
+}
+
+uint64_t UdpReassembly::Dropped() const
+{
+    return m_dropped;
+}
@@ -0,0 +1,77 @@
+#ifndef DEVIDROID_UDPREASSEMBLY_H
+#define DEVIDROID_UDPREASSEMBLY_H
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include "UdpSocket.h"
+
+// a complete message, data is only valid inside the hook
+typedef void(*MESSAGEHOOK)(uint64_t id, const char *data, size_t size, void *user);
+
+// puts NetProtocol slices back together, not thread safe: feed it from the receiving thread
+class UdpReassembly {
+public:
+    // headers are unauthenticated: a message over 'maxSize' is rejected and partials together
+    // never hold more than 'maxBytes', the oldest are evicted to make room
+    explicit UdpReassembly(MESSAGEHOOK hook, void *user = nullptr, unsigned int timeoutMs = 3000,
+                           size_t maxSize = 4 << 20, size_t maxPending = 64, size_t maxBytes = 16 << 20);
+
+    // 1: message delivered, 0: waiting for more slices, <0: slice rejected
+    int Input(const NetProtocol &header, const char *payload, size_t length, uint64_t peer = 0);
+
+    // UDPBATCHHOOK for UdpSocket::ReceiveBatch with 'this' as user
+    static void BatchHook(const UdpRecord *records, size_t count, void *user);
+
+    // evict partial messages idle longer than timeout, returns how many were dropped
+    size_t Expire();
+
+    size_t Pending() const;
+
+    // bytes held by partial messages
+    size_t Buffered() const;
+
+    uint64_t Dropped() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Key {
+        uint64_t peer;
+        uint64_t id;
+
+        bool operator==(const Key &key) const
+        { return peer == key.peer && id == key.id; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const
+        { return std::hash<uint64_t>()(key.id * 0x9E3779B97F4A7C15ULL ^ key.peer); }
+    };
+
+    struct Partial {
+        std::vector<char> buffer;
+        std::vector<uint64_t> bitmap;
+        uint64_t unit = 0;
+        uint64_t slices = 0;
+        uint64_t received = 0;
+        Clock::time_point last;
+    };
+
+    void EvictOldest();
+
+    MESSAGEHOOK m_hook;
+    void *m_user;
+    const std::chrono::milliseconds m_timeout;
+    const size_t m_maxSize;
+    const size_t m_maxPending;
+    const size_t m_maxBytes;
+    size_t m_bytes = 0;
+    uint64_t m_dropped = 0;
+    Clock::time_point m_sweep;
+    std::unordered_map<Key, Partial, KeyHash> m_partials;
+    // completed messages, so late duplicate slices do not open them again
+    std::unordered_map<Key, Clock::time_point, KeyHash> m_completed;
+};
+
+#endif //DEVIDROID_UDPREASSEMBLY_H
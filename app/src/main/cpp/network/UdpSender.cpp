@@ -0,0 +1,180 @@
+#include <unistd.h>
+#include <cstring>
+#include <sys/syscall.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG "UdpSender"
+#endif
+
+#include <Utils/logging.h>
+#include <cerrno>
+
+#include "UdpSender.h"
+
+namespace {
+    // bionic only declares sendmmsg from API 21
+    inline int SendMmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags)
+    {
+#if defined(__ANDROID_API__) && __ANDROID_API__ < 21
+        return static_cast<int>(syscall(__NR_sendmmsg, sock, msgs, vlen, flags));
+#else
+        return sendmmsg(sock, msgs, vlen, flags);
+#endif
+    }
+}
+
+UdpSender::UdpSender(const std::string &ip, int port, unsigned int batch) :
+        m_batch(batch > 0 ? batch : 1),
+        m_headers(m_batch),
+        m_iovs(m_batch * 2),
+        m_msgs(m_batch)
+{
+    m_peer.sin_family = AF_INET;
+    m_peer.sin_port = htons(port);
+    m_peer.sin_addr.s_addr = inet_addr(ip.c_str());
+    for (unsigned int i = 0; i < m_batch; i++) {
+        m_iovs[i * 2].iov_base = &m_headers[i];
+        m_iovs[i * 2].iov_len = sizeof(NetProtocol);
+        memset(&m_msgs[i], 0, sizeof(struct mmsghdr));
+        m_msgs[i].msg_hdr.msg_name = &m_peer;
+        m_msgs[i].msg_hdr.msg_namelen = sizeof(m_peer);
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i * 2];
+        m_msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    LOGI("construct of UdpSender, %s:%d, batch = %u.", ip.c_str(), port, m_batch);
+}
+
+UdpSender::~UdpSender()
+{
+    Flush();
+    if (m_socket >= 0) {
+        close(m_socket);
+    }
+}
+
+int UdpSender::Open()
+{
+    if (m_socket >= 0) {
+        return m_socket;
+    }
+    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_socket < 0) {
+        LOGE("socket: %s", strerror(errno));
+    }
+    return m_socket;
+}
+
+int UdpSender::Queue(const char *buffer, size_t length)
+{
+    // messages longer than one slice are split, each slice takes a batch entry
+    uint64_t id = ++m_id;
+    uint64_t offset = 0;
+    uint64_t index = 0;
+    do {
+        if (m_count >= m_batch && Flush() < 0) {
+            return -1;
+        }
+        uint64_t slice = length - offset < UDP_SLICE_LEN ? length - offset : UDP_SLICE_LEN;
+        NetProtocol &header = m_headers[m_count];
+        header.id = id;
+        header.size = length;
+        header.slice = slice;
+        header.s_idx = index++;
+        header.s_size = slice + sizeof(NetProtocol);
+        header.offset = offset;
+        header.remain = length - offset - slice;
+        m_iovs[m_count * 2 + 1].iov_base = const_cast<char *>(buffer + offset);
+        m_iovs[m_count * 2 + 1].iov_len = slice;
+        m_count++;
+        offset += slice;
+    } while (offset < length);
+    return static_cast<int>(m_count);
+}
+
+void UdpSender::SetFec(unsigned int data, unsigned int parity)
+{
+    Flush();
+    m_fec.reset(data > 0 ? new FecEncoder(data, parity, FecOutput, this) : nullptr);
+}
+
+void UdpSender::FecOutput(const char *data, size_t size, void *user)
+{
+    auto *sender = static_cast<UdpSender *>(user);
+    if (sendto(sender->m_socket, data, size, 0, (struct sockaddr *) &sender->m_peer, sizeof(sender->m_peer)) < 0) {
+        sender->m_fecError = errno;
+        LOGE("sendto fec datagram: %s", strerror(errno));
+    }
+}
+
+int UdpSender::FlushFec()
+{
+    // the encoder wants each datagram in one piece, header and slice are joined first
+    size_t sent = 0;
+    m_fecError = 0;
+    for (; sent < m_count && m_fecError == 0; sent++) {
+        const struct iovec &payload = m_iovs[sent * 2 + 1];
+        m_slice.resize(sizeof(NetProtocol) + payload.iov_len);
+        memcpy(m_slice.data(), &m_headers[sent], sizeof(NetProtocol));
+        memcpy(m_slice.data() + sizeof(NetProtocol), payload.iov_base, payload.iov_len);
+        if (m_fec->Encode(m_slice.data(), m_slice.size()) < 0) {
+            LOGE("fec encode of %zu/%zu failed.", sent, m_count);
+            break;
+        }
+    }
+    // parity for the tail now instead of with the next flush
+    m_fec->Flush();
+    size_t count = m_count;
+    m_count = 0;
+    if (sent < count || m_fecError != 0) {
+        return -1;
+    }
+    m_sent += sent;
+    return static_cast<int>(sent);
+}
+
+int UdpSender::Flush()
+{
+    if (m_count == 0) {
+        return 0;
+    }
+    if (Open() < 0) {
+        return -1;
+    }
+    if (m_fec != nullptr) {
+        return FlushFec();
+    }
+    size_t sent = 0;
+    while (sent < m_count) {
+        int num = SendMmsg(m_socket, &m_msgs[sent], static_cast<unsigned int>(m_count - sent), 0);
+        if (num < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            LOGE("sendmmsg(%zu/%zu): %s", sent, m_count, strerror(errno));
+            break;
+        }
+        sent += num;
+    }
+    size_t count = m_count;
+    m_count = 0;
+    if (sent < count) {
+        return -1;
+    }
+    m_sent += sent;
+    return static_cast<int>(sent);
+}
+
+int UdpSender::Send(const char *buffer, size_t length)
+{
+    // a long message is flushed a batch at a time inside Queue, count all of them
+    uint64_t before = m_sent;
+    if (Queue(buffer, length) < 0 || Flush() < 0) {
+        return -1;
+    }
+    return static_cast<int>(m_sent - before);
+}
+
+size_t UdpSender::Pending() const
+{
+    return m_count;
+}
@@ -0,0 +1,57 @@
+#ifndef DEVIDROID_UDPSENDER_H
+#define DEVIDROID_UDPSENDER_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FecCodec.h"
+#include "UdpSocket.h"
+
+// long-lived udp sender, queued messages go out together in one sendmmsg
+class UdpSender {
+public:
+    UdpSender(const std::string &ip, int port, unsigned int batch = 32);
+
+    ~UdpSender();
+
+    // buffer is referenced, not copied, and must stay valid until Flush;
+    // it is sent in UDP_SLICE_LEN slices that UdpReassembly puts back together.
+    // pending datagrams, <0 if a flush to make room failed and the message was cut short
+    int Queue(const char *buffer, size_t length);
+
+    // datagrams sent, <0 if any of them was not
+    int Flush();
+
+    // datagrams this call sent (every slice of the message plus what was queued before), <0 if any was not
+    int Send(const char *buffer, size_t length);
+
+    size_t Pending() const;
+
+    // slices go out in fec groups of 'data' + 'parity' datagrams instead of one sendmmsg,
+    // the receiver needs UdpSocket::SetFec with the same values; 0 turns it off
+    void SetFec(unsigned int data, unsigned int parity);
+
+private:
+    int Open();
+
+    int FlushFec();
+
+    static void FecOutput(const char *data, size_t size, void *user);
+
+    int m_socket = -1;
+    struct sockaddr_in m_peer{};
+    uint64_t m_id = 0;
+    size_t m_count = 0;
+    const unsigned int m_batch;
+    std::vector<NetProtocol> m_headers;
+    std::vector<struct iovec> m_iovs;
+    std::vector<struct mmsghdr> m_msgs;
+    std::unique_ptr<FecEncoder> m_fec;
+    std::vector<char> m_slice;
+    int m_fecError = 0;
+    uint64_t m_sent = 0;
+};
+
+#endif //DEVIDROID_UDPSENDER_H
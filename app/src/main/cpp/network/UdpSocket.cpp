@@ -4,6 +4,12 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 
 #ifndef LOG_TAG
 #define LOG_TAG "UdpSocket"
@@ -14,7 +20,69 @@
 
 #include "UdpSocket.h"
 
-constexpr const int LOCAL_PORT = 8899;
+// fec decoders kept per sender: the least recently heard one makes room for a new sender,
+// and one silent for this long is dropped with its half-received groups
+constexpr const size_t FEC_MAX_PEERS = 64;
+constexpr const int FEC_PEER_IDLE_MS = 30000;
+
+namespace {
+    // bionic only declares recvmmsg from API 21
+    inline int RecvMmsg(int sock, struct mmsghdr *msgs, unsigned int vlen, int flags)
+    {
+#if defined(__ANDROID_API__) && __ANDROID_API__ < 21
+        return static_cast<int>(syscall(__NR_recvmmsg, sock, msgs, vlen, flags, nullptr));
+#else
+        return recvmmsg(sock, msgs, vlen, flags, nullptr);
+#endif
+    }
+
+    std::atomic<uint64_t> g_benchCount{0};
+    std::chrono::steady_clock::time_point g_benchFirst;
+    std::chrono::steady_clock::time_point g_benchLast;
+
+    void BenchStamp(size_t num)
+    {
+        if (g_benchCount.fetch_add(num) == 0) {
+            g_benchFirst = std::chrono::steady_clock::now();
+        }
+        g_benchLast = std::chrono::steady_clock::now();
+    }
+
+    void BenchSingle(char *)
+    {
+        BenchStamp(1);
+    }
+
+    void BenchBatch(const UdpRecord *, size_t num, void *)
+    {
+        BenchStamp(num);
+    }
+
+    // what FecDecoder passes on or rebuilds, handed to the batch hook as a single record
+    struct FecContext {
+        UDPBATCHHOOK callback;
+        void *user;
+        struct sockaddr_in remote;
+        uint64_t count;
+    };
+
+    void FecDeliver(const char *data, size_t size, void *user)
+    {
+        auto *context = static_cast<FecContext *>(user);
+        if (size < sizeof(NetProtocol)) {
+            return;
+        }
+        UdpRecord record{};
+        record.header = reinterpret_cast<const NetProtocol *>(data);
+        record.payload = data + sizeof(NetProtocol);
+        record.length = size - sizeof(NetProtocol);
+        record.remote = context->remote;
+        context->count++;
+        if (context->callback != nullptr) {
+            context->callback(&record, 1, context->user);
+        }
+    }
+}
 
 UdpSocket::UdpSocket() = default;
 
@@ -39,6 +107,12 @@ int UdpSocket::Sender(const char *sendBuff, size_t length)
     peer.sin_addr.s_addr = inet_addr(this->m_ip.c_str());
     m_peer = peer;
     protocol.id++;
+    protocol.size = length;
+    protocol.slice = length;
+    protocol.s_idx = 0;
+    protocol.s_size = length + m_proSize;
+    protocol.offset = 0;
+    protocol.remain = 0;
     int opt = 1;
     setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const void *) &opt, sizeof(opt));
 
@@ -48,10 +122,14 @@ int UdpSocket::Sender(const char *sendBuff, size_t length)
     memcpy(message, &protocol, m_proSize);
     memcpy(message + m_proSize, sendBuff, length);
 
-    int iRet = sendto(m_socket, (char *) message, total, 0, (struct sockaddr *) &peer, m_addLen);
-    if (iRet > 0)
+    int iRet;
+    if (m_fec != nullptr) {
+        // with fec every datagram has to go through the encoder, which only SendBySlice does
+        if ((iRet = SendBySlice(sendBuff, length)) < 0)
+            LOGE("Udp fec send(%d) error!", iRet);
+    } else if ((iRet = sendto(m_socket, (char *) message, total, 0, (struct sockaddr *) &peer, m_addLen)) > 0) {
         LOGI("Udp send(%d):[%s]", iRet, message + m_proSize);
-    else {
+    } else {
         if ((iRet = SendBySlice(sendBuff, length)) < 0)
             LOGE("Udp send(%d) error!", iRet);
     }
@@ -67,24 +145,9 @@ int UdpSocket::Receiver(char *rcvBuff, int len, void(*callback)(char*))
         return m_socket;
     }
 
-    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (m_socket < 0) {
-        LOGE("socket: %s", strerror(errno));
-        return -1;
-    }
-
-    struct sockaddr_in local{};
-    local.sin_family = AF_INET;
-    local.sin_port = htons(LOCAL_PORT);
-    local.sin_addr.s_addr = htonl(INADDR_ANY);
-    int opt = 1;
-    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const void *) &opt, sizeof(opt));
-
-    if (bind(m_socket, (struct sockaddr *) &local, sizeof(local)) < 0) {
-        LOGE("bind: %s", strerror(errno));
+    if (BindLocal(m_localPort) < 0) {
         return -1;
     }
-    LOGI("UdpSocket Receiver bind success");
 
     fd_set fds;
     int maxFdp = m_socket + 1;
@@ -122,37 +185,286 @@ int UdpSocket::Receiver(char *rcvBuff, int len, void(*callback)(char*))
     return 0;
 }
 
+int UdpSocket::BindLocal(unsigned short port)
+{
+    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_socket < 0) {
+        LOGE("socket: %s", strerror(errno));
+        return -1;
+    }
+
+    struct sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    int opt = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const void *) &opt, sizeof(opt));
+
+    if (bind(m_socket, (struct sockaddr *) &local, sizeof(local)) < 0) {
+        LOGE("bind: %s", strerror(errno));
+        close(m_socket);
+        m_socket = -1;
+        return -1;
+    }
+    auto len = static_cast<socklen_t>(sizeof(local));
+    if (getsockname(m_socket, (struct sockaddr *) &local, &len) == 0) {
+        m_boundPort = ntohs(local.sin_port);
+    }
+    LOGI("UdpSocket Receiver bind [%d] success", m_boundPort.load());
+    return m_socket;
+}
+
+int UdpSocket::ReceiveBatch(UDPBATCHHOOK callback, void *user, unsigned int batch)
+{
+    if (m_socket != -1 && m_flag) {
+        LOGE("socket %d already in receiving.", m_socket);
+        return m_socket;
+    }
+    if (batch == 0) {
+        batch = 1;
+    }
+    if (BindLocal(m_localPort) < 0) {
+        return -1;
+    }
+    // wake up to check m_flag like the select timeout of Receiver
+    struct timeval timeout{};
+    timeout.tv_sec = 3;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, (const void *) &timeout, sizeof(timeout));
+    // room for bursts of slices, capped by net.core.rmem_max
+    int rcvBuf = 4 << 20;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, (const void *) &rcvBuf, sizeof(rcvBuf));
+
+    // slots keep NetProtocol aligned, so headers are read in place; fec keeps that 8 bytes in
+    const size_t capacity = m_proSize + SLICE_LEN + (m_fecData > 0 ? FEC_OVERHEAD : 0);
+    const size_t stride = (capacity + alignof(NetProtocol) - 1) / alignof(NetProtocol) * alignof(NetProtocol);
+    std::vector<char> slots(stride * batch);
+    std::vector<struct iovec> iovs(batch);
+    std::vector<struct mmsghdr> msgs(batch);
+    std::vector<struct sockaddr_in> remotes(batch);
+    std::vector<UdpRecord> records(batch);
+    // group numbers are per sender
+    struct FecPeer {
+        std::unique_ptr<FecDecoder> decoder;
+        std::chrono::steady_clock::time_point heard;
+    };
+    std::unordered_map<uint64_t, FecPeer> decoders;
+    auto lastSweep = std::chrono::steady_clock::now();
+    FecContext context{callback, user, {}, 0};
+    for (unsigned int i = 0; i < batch; i++) {
+        iovs[i].iov_base = slots.data() + i * stride;
+        iovs[i].iov_len = capacity;
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_name = &remotes[i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint64_t total = 0;
+    while (!m_flag) {
+        for (unsigned int i = 0; i < batch; i++) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msgs[i].msg_hdr.msg_flags = 0;
+        }
+        int num = RecvMmsg(m_socket, msgs.data(), batch, MSG_WAITFORONE);
+        auto now = std::chrono::steady_clock::now();
+        if (!decoders.empty() && now - lastSweep > std::chrono::milliseconds(FEC_PEER_IDLE_MS)) {
+            lastSweep = now;
+            for (auto it = decoders.begin(); it != decoders.end();) {
+                if (now - it->second.heard > std::chrono::milliseconds(FEC_PEER_IDLE_MS)) {
+                    it = decoders.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        if (num < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            LOGE("recvmmsg: %s", strerror(errno));
+            break;
+        }
+        size_t count = 0;
+        for (int i = 0; i < num; i++) {
+            size_t len = msgs[i].msg_len;
+            if (m_fecData > 0 && !(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                uint64_t key = (uint64_t) remotes[i].sin_addr.s_addr << 16 | remotes[i].sin_port;
+                auto peer = decoders.find(key);
+                if (peer == decoders.end()) {
+                    if (decoders.size() >= FEC_MAX_PEERS) {
+                        auto oldest = decoders.begin();
+                        for (auto it = decoders.begin(); it != decoders.end(); ++it) {
+                            if (it->second.heard < oldest->second.heard) {
+                                oldest = it;
+                            }
+                        }
+                        decoders.erase(oldest);
+                    }
+                    peer = decoders.emplace(key, FecPeer{std::unique_ptr<FecDecoder>(
+                            new FecDecoder(FecDeliver, &context)), now}).first;
+                }
+                peer->second.heard = now;
+                context.remote = remotes[i];
+                peer->second.decoder->Input(static_cast<const char *>(iovs[i].iov_base), len);
+                continue;
+            }
+            if (len < m_proSize || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                LOGE("drop datagram of %zu bytes from [%s:%d].", len,
+                     inet_ntoa(remotes[i].sin_addr), ntohs(remotes[i].sin_port));
+                continue;
+            }
+            UdpRecord &record = records[count++];
+            record.header = reinterpret_cast<const NetProtocol *>(iovs[i].iov_base);
+            record.payload = static_cast<const char *>(iovs[i].iov_base) + m_proSize;
+            record.length = len - m_proSize;
+            record.remote = remotes[i];
+        }
+        total += count;
+        if (count > 0 && callback != nullptr) {
+            callback(records.data(), count, user);
+        }
+    }
+    close(m_socket);
+    m_socket = -1;
+    total += context.count;
+    LOGI("UdpSocket batch receiver quit, %llu datagrams.", (unsigned long long) total);
+    return 0;
+}
+
+void UdpSocket::Finish()
+{
+    m_flag = true;
+}
+
+void UdpSocket::SetFec(unsigned int data, unsigned int parity)
+{
+    m_fecData = data;
+    m_fecParity = parity;
+    m_fec.reset(data > 0 ? new FecEncoder(data, parity, FecOutput, this) : nullptr);
+}
+
+void UdpSocket::FecOutput(const char *data, size_t size, void *user)
+{
+    auto *sock = static_cast<UdpSocket *>(user);
+    if (sendto(sock->m_socket, data, size, 0, (struct sockaddr *) &sock->m_peer, sock->m_addLen) < 0) {
+        LOGE("sendto fec datagram: %s", strerror(errno));
+    }
+}
+
+void UdpSocket::SetLocalPort(unsigned short port)
+{
+    m_localPort = port;
+}
+
+unsigned short UdpSocket::LocalPort() const
+{
+    return m_boundPort;
+}
+
+int UdpSocket::Benchmark(unsigned int count, unsigned int batch)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        LOGE("socket: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_in peer{};
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    char packet[sizeof(NetProtocol) + 64];
+    memset(packet, 0, sizeof(NetProtocol));
+    memset(packet + sizeof(NetProtocol), 'u', sizeof(packet) - sizeof(NetProtocol) - 1);
+    packet[sizeof(packet) - 1] = '\0';
+
+    const char *names[2] = {"recvfrom", "recvmmsg"};
+    double rates[2] = {};
+    for (int mode = 0; mode < 2; mode++) {
+        g_benchCount = 0;
+        // a port of its own, a running udp server on LOCAL_PORT would share the datagrams through SO_REUSEADDR
+        UdpSocket receiver;
+        receiver.SetLocalPort(0);
+        std::thread th([&receiver, mode, batch]() -> void {
+            if (mode == 0) {
+                char buffer[sizeof(NetProtocol) + 1024 + 1];
+                receiver.Receiver(buffer, sizeof(buffer) - 1, BenchSingle);
+            } else {
+                receiver.ReceiveBatch(BenchBatch, nullptr, batch);
+            }
+        });
+        usleep(100000);
+        if (receiver.LocalPort() == 0) {
+            LOGE("udp %s receiver did not bind.", names[mode]);
+            receiver.Finish();
+            th.join();
+            close(sock);
+            return -1;
+        }
+        peer.sin_port = htons(receiver.LocalPort());
+        for (unsigned int i = 0; i < count; i++) {
+            sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *) &peer, sizeof(peer));
+        }
+        usleep(100000);
+        receiver.Finish();
+        // one to unblock the receive call, one to skip the select wait of Receiver
+        sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *) &peer, sizeof(peer));
+        sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *) &peer, sizeof(peer));
+        th.join();
+
+        uint64_t received = g_benchCount;
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                g_benchLast - g_benchFirst).count();
+        rates[mode] = elapsed > 0 ? received * 1000000.0 / elapsed : 0;
+        LOGI("udp %s receiver: %llu/%u datagrams in %lldus, %.0f packets/sec.", names[mode],
+             (unsigned long long) received, count, (long long) elapsed, rates[mode]);
+    }
+    close(sock);
+    LOGI("udp batch(%u) receiver speedup: %.2fx.", batch, rates[0] > 0 ? rates[1] / rates[0] : 0);
+    return static_cast<int>(rates[1]);
+}
+
 int UdpSocket::SendBySlice(const char *sliceBuffer, size_t length)
 {
     int iRet = 0;
     protocol.s_idx = 0;
     protocol.size = length;
     uint64_t offset = 0;
-    uint64_t slice = SLICE_LEN;
-    uint64_t remain = length;
-
-    while (protocol.remain > 0) {
-        uint32_t size = slice + m_proSize;
-        auto *message = new(std::nothrow) uint8_t[size];
-        memset(message, 0, size);
 
+    struct iovec iov[2];
+    struct msghdr msg{};
+    msg.msg_name = &m_peer;
+    msg.msg_namelen = m_addLen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    while (offset < length) {
+        uint64_t slice = length - offset < SLICE_LEN ? length - offset : SLICE_LEN;
         protocol.slice = slice;
-        protocol.s_size = size;
+        protocol.s_size = slice + m_proSize;
         protocol.offset = offset;
-        protocol.remain = remain;
-
-        memcpy(message, &protocol, m_proSize);
-        memcpy(message + m_proSize, sliceBuffer + offset, slice);
+        protocol.remain = length - offset - slice;
 
-        iRet = sendto(m_socket, message, size, 0, (struct sockaddr *) &m_peer, m_addLen);
-        delete[] message;
-
-        remain = length - slice;
-        if (offset + slice <= length)
-            offset += slice;
-        else
-            offset = slice = length - offset;
+        if (m_fec != nullptr) {
+            m_slice.resize(m_proSize + slice);
+            memcpy(m_slice.data(), &protocol, m_proSize);
+            memcpy(m_slice.data() + m_proSize, sliceBuffer + offset, slice);
+            iRet = m_fec->Encode(m_slice.data(), m_slice.size()) < 0 ? -1 : static_cast<int>(m_slice.size());
+        } else {
+            iov[0].iov_base = &protocol;
+            iov[0].iov_len = m_proSize;
+            iov[1].iov_base = const_cast<char *>(sliceBuffer + offset);
+            iov[1].iov_len = slice;
+            iRet = sendmsg(m_socket, &msg, 0);
+        }
+        if (iRet < 0) {
+            LOGE("sendmsg slice %llu: %s", (unsigned long long) protocol.s_idx, strerror(errno));
+            break;
+        }
+        offset += slice;
         protocol.s_idx++;
     }
+    // parity for the tail of the message instead of waiting for the next one
+    if (m_fec != nullptr) {
+        m_fec->Flush();
+    }
     return iRet;
 }
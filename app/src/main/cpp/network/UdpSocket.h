@@ -2,7 +2,14 @@
 #define DEVIDROID_UdpSocket_H
 
 #include <arpa/inet.h>
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
+#include "FecCodec.h"
+
+constexpr const uint32_t UDP_SLICE_LEN = 1024;
+constexpr const unsigned short LOCAL_PORT = 8899;
 
 struct NetProtocol {
     uint64_t id;
@@ -14,17 +21,33 @@ struct NetProtocol {
     uint64_t remain;
 };
 
+// one datagram of a batch, header and payload point into the receiver's slot array
+struct UdpRecord {
+    const NetProtocol *header;
+    const char *payload;
+    size_t length;
+    struct sockaddr_in remote;
+};
+
+typedef void(*UDPBATCHHOOK)(const UdpRecord *, size_t, void *);
+
 class UdpSocket {
 private:
     int m_socket = -1;
     std::string m_ip = {};
     int m_port = 0;
-    int m_flag = false;
+    unsigned short m_localPort = LOCAL_PORT;
+    std::atomic<unsigned short> m_boundPort{0};
+    std::atomic<bool> m_flag{false};
     NetProtocol protocol{};
     struct sockaddr_in m_peer{};
-    const uint32_t SLICE_LEN = 1024;
+    const uint32_t SLICE_LEN = UDP_SLICE_LEN;
     const uint32_t m_proSize = sizeof(NetProtocol);
     const uint32_t m_addLen = sizeof(struct sockaddr);
+    unsigned int m_fecData = 0;
+    unsigned int m_fecParity = 0;
+    std::unique_ptr<FecEncoder> m_fec;
+    std::vector<char> m_slice;
 public:
     UdpSocket();
 
@@ -34,8 +57,30 @@ public:
 
     int Receiver(char *, int, void(*)(char*) = nullptr);
 
+    // receive up to 'batch' datagrams per syscall (recvmmsg), records are valid inside callback only;
+    // with fec the callback gets one record at a time, including the ones rebuilt from parity
+    int ReceiveBatch(UDPBATCHHOOK, void *user = nullptr, unsigned int batch = 32);
+
+    // slices go out in fec groups of 'data' + 'parity' datagrams, both ends must agree; 0 turns it off
+    void SetFec(unsigned int data, unsigned int parity);
+
+    // port Receiver/ReceiveBatch bind, 0 lets the kernel pick a free one
+    void SetLocalPort(unsigned short port);
+
+    // port actually bound, 0 until a receive call has bound it
+    unsigned short LocalPort() const;
+
+    void Finish();
+
+    // loopback packets/sec of Receiver against ReceiveBatch
+    static int Benchmark(unsigned int count = 100000, unsigned int batch = 32);
+
 private:
+    int BindLocal(unsigned short port = LOCAL_PORT);
+
     int SendBySlice(const char *, size_t);
+
+    static void FecOutput(const char *, size_t, void *);
 };
 
 #endif //DEVIDROID_UdpSocket_H
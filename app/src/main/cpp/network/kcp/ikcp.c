@@ -148,25 +148,29 @@ static void (*ikcp_free_hook)(void *) = NULL;
 
 // internal malloc
 static void* ikcp_malloc(size_t size) {
-    if (ikcp_malloc_hook)
-        return ikcp_malloc_hook(size);
+    void* (*hook)(size_t) = __atomic_load_n(&ikcp_malloc_hook, __ATOMIC_ACQUIRE);
+    if (hook)
+        return hook(size);
     return malloc(size);
 }
 
 // internal free
 static void ikcp_free(void *ptr) {
-    if (ikcp_free_hook) {
-        ikcp_free_hook(ptr);
+    void (*hook)(void *) = __atomic_load_n(&ikcp_free_hook, __ATOMIC_ACQUIRE);
+    if (hook) {
+        hook(ptr);
     }	else {
         free(ptr);
     }
 }
 
-// redefine allocator
+// redefine allocator: only before the first ikcp_create, a block must be
+// freed by the allocator that made it. the hooks are read from every kcp
+// thread, so they are stored atomically, free first so malloc never runs ahead
 void ikcp_allocator(void* (*new_malloc)(size_t), void (*new_free)(void*))
 {
-    ikcp_malloc_hook = new_malloc;
-    ikcp_free_hook = new_free;
+    __atomic_store_n(&ikcp_free_hook, new_free, __ATOMIC_RELEASE);
+    __atomic_store_n(&ikcp_malloc_hook, new_malloc, __ATOMIC_RELEASE);
 }
 
 // allocate a new kcp segment
@@ -212,6 +216,57 @@ static int ikcp_output(ikcpcb *kcp, const void *data, int size)
     return kcp->output((const char*)data, size, kcp, kcp->user);
 }
 
+// hand the pending batch to outputv
+static void ikcp_output_batch(ikcpcb *kcp)
+{
+    if (kcp->batch_count > 0) {
+        kcp->outputv(kcp->batch_buf, kcp->batch_len, kcp->batch_count, kcp, kcp->user);
+        kcp->batch_count = 0;
+    }
+}
+
+// one datagram of a flush is done, returns where the next one is built
+static char *ikcp_output_push(ikcpcb *kcp, char *buffer, int size)
+{
+    if (kcp->outputv == NULL) {
+        ikcp_output(kcp, buffer, size);
+        return kcp->buffer;
+    }
+    if (size == 0) return buffer;
+    if (ikcp_canlog(kcp, IKCP_LOG_OUTPUT)) {
+        ikcp_log(kcp, IKCP_LOG_OUTPUT, "[RO] %ld bytes", (long)size);
+    }
+    kcp->batch_buf[kcp->batch_count] = buffer;
+    kcp->batch_len[kcp->batch_count] = size;
+    kcp->batch_count++;
+    buffer += size;
+    // a datagram never exceeds mtu, so 'batch_max' of them fit the arena
+    if (kcp->batch_count >= kcp->batch_max) {
+        ikcp_output_batch(kcp);
+        buffer = kcp->batch;
+    }
+    return buffer;
+}
+
+// pointer arrays and datagram arena of batch output in one block
+static int ikcp_batch_alloc(ikcpcb *kcp, int maxbatch, IUINT32 mtu)
+{
+    size_t head = (sizeof(const char*) + sizeof(int)) * maxbatch;
+    char *block;
+    head = (head + 7) & ~((size_t)7);
+    block = (char*)ikcp_malloc(head + maxbatch * mtu + (mtu + IKCP_OVERHEAD) * 3);
+    if (block == NULL) return -1;
+    if (kcp->batch_buf) {
+        ikcp_free(kcp->batch_buf);
+    }
+    kcp->batch_buf = (const char**)block;
+    kcp->batch_len = (int*)(block + sizeof(const char*) * maxbatch);
+    kcp->batch = block + head;
+    kcp->batch_count = 0;
+    kcp->batch_max = maxbatch;
+    return 0;
+}
+
 // output queue
 void ikcp_qprint(const char *name, const struct IQUEUEHEAD *head)
 {
@@ -260,6 +315,20 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
         return NULL;
     }
 
+    kcp->snd_mask = IKCP_WND_SND - 1;
+    kcp->rcv_mask = IKCP_WND_RCV - 1;
+    kcp->snd_ring = (IKCPSEG**)ikcp_malloc(sizeof(IKCPSEG*) * IKCP_WND_SND);
+    kcp->rcv_ring = (IKCPSEG**)ikcp_malloc(sizeof(IKCPSEG*) * IKCP_WND_RCV);
+    if (kcp->snd_ring == NULL || kcp->rcv_ring == NULL) {
+        if (kcp->snd_ring) ikcp_free(kcp->snd_ring);
+        if (kcp->rcv_ring) ikcp_free(kcp->rcv_ring);
+        ikcp_free(kcp->buffer);
+        ikcp_free(kcp);
+        return NULL;
+    }
+    memset(kcp->snd_ring, 0, sizeof(IKCPSEG*) * IKCP_WND_SND);
+    memset(kcp->rcv_ring, 0, sizeof(IKCPSEG*) * IKCP_WND_RCV);
+
     iqueue_init(&kcp->snd_queue);
     iqueue_init(&kcp->rcv_queue);
     iqueue_init(&kcp->snd_buf);
@@ -270,6 +339,12 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
     kcp->nsnd_que = 0;
     kcp->state = 0;
     kcp->acklist = NULL;
+    kcp->outputv = NULL;
+    kcp->batch_buf = NULL;
+    kcp->batch_len = NULL;
+    kcp->batch = NULL;
+    kcp->batch_count = 0;
+    kcp->batch_max = 0;
     kcp->ackblock = 0;
     kcp->ackcount = 0;
     kcp->rx_srtt = 0;
@@ -329,6 +404,11 @@ void ikcp_release(ikcpcb *kcp)
         if (kcp->acklist) {
             ikcp_free(kcp->acklist);
         }
+        ikcp_free(kcp->snd_ring);
+        ikcp_free(kcp->rcv_ring);
+        if (kcp->batch_buf) {
+            ikcp_free(kcp->batch_buf);
+        }
 
         kcp->nrcv_buf = 0;
         kcp->nsnd_buf = 0;
@@ -337,6 +417,8 @@ void ikcp_release(ikcpcb *kcp)
         kcp->ackcount = 0;
         kcp->buffer = NULL;
         kcp->acklist = NULL;
+        kcp->snd_ring = NULL;
+        kcp->rcv_ring = NULL;
         ikcp_free(kcp);
     }
 }
@@ -351,6 +433,82 @@ void ikcp_setoutput(ikcpcb *kcp, int (*output)(const char *buf, int len,
     kcp->output = output;
 }
 
+int ikcp_setoutputv(ikcpcb *kcp, int (*outputv)(const char **bufs, const int *lens,
+                                                int count, ikcpcb *kcp, void *user), int maxbatch)
+{
+    if (outputv == NULL) {
+        kcp->outputv = NULL;
+        return 0;
+    }
+    if (maxbatch <= 0) return -1;
+    if (maxbatch != kcp->batch_max && ikcp_batch_alloc(kcp, maxbatch, kcp->mtu) < 0)
+        return -2;
+    kcp->outputv = outputv;
+    return 0;
+}
+
+
+//---------------------------------------------------------------------
+// ring index of snd_buf/rcv_buf: every sn in a buffer lies within
+// mask + 1 of its lower edge (snd_una/rcv_nxt), so sn & mask is unique
+//---------------------------------------------------------------------
+static void ikcp_ring_grow(ikcpcb *kcp, IKCPSEG ***ring, IUINT32 *mask,
+                           const struct IQUEUEHEAD *head, IUINT32 span)
+{
+    IUINT32 size = *mask + 1;
+    IKCPSEG **grown;
+    const struct IQUEUEHEAD *p;
+
+    while (size <= span) size <<= 1;
+    grown = (IKCPSEG**)ikcp_malloc(sizeof(IKCPSEG*) * size);
+    if (grown == NULL) {
+        assert(grown != NULL);
+        abort();
+    }
+    memset(grown, 0, sizeof(IKCPSEG*) * size);
+    for (p = head->next; p != head; p = p->next) {
+        IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+        grown[seg->sn & (size - 1)] = seg;
+    }
+    ikcp_free(*ring);
+    *ring = grown;
+    *mask = size - 1;
+}
+
+#ifdef IKCP_RING_CHECK
+// differential check: the ring must agree with the original linear walk
+static IKCPSEG *ikcp_ring_lookup(const struct IQUEUEHEAD *head, IUINT32 sn)
+{
+    const struct IQUEUEHEAD *p;
+    for (p = head->next; p != head; p = p->next) {
+        IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+        if (seg->sn == sn) return seg;
+    }
+    return NULL;
+}
+#define IKCP_RING_ASSERT(ring, mask, head, key) \
+    assert(ikcp_ring_lookup(head, key) == ((ring)[(key) & (mask)] && \
+        (ring)[(key) & (mask)]->sn == (key) ? (ring)[(key) & (mask)] : NULL))
+#else
+#define IKCP_RING_ASSERT(ring, mask, head, key)
+#endif
+
+static void ikcp_move_rcv_buf(ikcpcb *kcp)
+{
+    while (kcp->nrcv_que < kcp->rcv_wnd) {
+        IKCPSEG **slot = &kcp->rcv_ring[kcp->rcv_nxt & kcp->rcv_mask];
+        IKCPSEG *seg = *slot;
+        IKCP_RING_ASSERT(kcp->rcv_ring, kcp->rcv_mask, &kcp->rcv_buf, kcp->rcv_nxt);
+        if (seg == NULL) break;
+        *slot = NULL;
+        iqueue_del(&seg->node);
+        kcp->nrcv_buf--;
+        iqueue_add_tail(&seg->node, &kcp->rcv_queue);
+        kcp->nrcv_que++;
+        kcp->rcv_nxt++;
+    }
+}
+
 
 //---------------------------------------------------------------------
 // user/upper level recv: returns size, returns below zero for EAGAIN
@@ -411,18 +569,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
     assert(len == peeksize);
 
     // move available data from rcv_buf -> rcv_queue
-    while (! iqueue_is_empty(&kcp->rcv_buf)) {
-        seg = iqueue_entry(kcp->rcv_buf.next, IKCPSEG, node);
-        if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
-            iqueue_del(&seg->node);
-            kcp->nrcv_buf--;
-            iqueue_add_tail(&seg->node, &kcp->rcv_queue);
-            kcp->nrcv_que++;
-            kcp->rcv_nxt++;
-        }	else {
-            break;
-        }
-    }
+    ikcp_move_rcv_buf(kcp);
 
     // fast recover
     if (kcp->nrcv_que < kcp->rcv_wnd && recover) {
@@ -570,23 +717,19 @@ static void ikcp_shrink_buf(ikcpcb *kcp)
 
 static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn)
 {
-    struct IQUEUEHEAD *p, *next;
+    IKCPSEG **slot;
 
     if (_itimediff(sn, kcp->snd_una) < 0 || _itimediff(sn, kcp->snd_nxt) >= 0)
         return;
 
-    for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = next) {
-        IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
-        next = p->next;
-        if (sn == seg->sn) {
-            iqueue_del(p);
-            ikcp_segment_delete(kcp, seg);
-            kcp->nsnd_buf--;
-            break;
-        }
-        if (_itimediff(sn, seg->sn) < 0) {
-            break;
-        }
+    IKCP_RING_ASSERT(kcp->snd_ring, kcp->snd_mask, &kcp->snd_buf, sn);
+    slot = &kcp->snd_ring[sn & kcp->snd_mask];
+    if (*slot != NULL && (*slot)->sn == sn) {
+        IKCPSEG *seg = *slot;
+        *slot = NULL;
+        iqueue_del(&seg->node);
+        ikcp_segment_delete(kcp, seg);
+        kcp->nsnd_buf--;
     }
 }
 
@@ -597,6 +740,7 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
         IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
         next = p->next;
         if (_itimediff(una, seg->sn) > 0) {
+            kcp->snd_ring[seg->sn & kcp->snd_mask] = NULL;
             iqueue_del(p);
             ikcp_segment_delete(kcp, seg);
             kcp->nsnd_buf--;
@@ -682,9 +826,8 @@ static void ikcp_ack_get(const ikcpcb *kcp, int p, IUINT32 *sn, IUINT32 *ts)
 //---------------------------------------------------------------------
 void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 {
-    struct IQUEUEHEAD *p, *prev;
     IUINT32 sn = newseg->sn;
-    int repeat = 0;
+    IKCPSEG **slot;
 
     if (_itimediff(sn, kcp->rcv_nxt + kcp->rcv_wnd) >= 0 ||
         _itimediff(sn, kcp->rcv_nxt) < 0) {
@@ -692,21 +835,17 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
         return;
     }
 
-    for (p = kcp->rcv_buf.prev; p != &kcp->rcv_buf; p = prev) {
-        IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
-        prev = p->prev;
-        if (seg->sn == sn) {
-            repeat = 1;
-            break;
-        }
-        if (_itimediff(sn, seg->sn) > 0) {
-            break;
-        }
+    if (sn - kcp->rcv_nxt > kcp->rcv_mask) {
+        ikcp_ring_grow(kcp, &kcp->rcv_ring, &kcp->rcv_mask, &kcp->rcv_buf, sn - kcp->rcv_nxt);
     }
 
-    if (repeat == 0) {
+    // rcv_buf itself is unordered, segments leave it through the ring in sn order
+    IKCP_RING_ASSERT(kcp->rcv_ring, kcp->rcv_mask, &kcp->rcv_buf, sn);
+    slot = &kcp->rcv_ring[sn & kcp->rcv_mask];
+    if (*slot == NULL) {
+        *slot = newseg;
         iqueue_init(&newseg->node);
-        iqueue_add(&newseg->node, p);
+        iqueue_add_tail(&newseg->node, &kcp->rcv_buf);
         kcp->nrcv_buf++;
     }	else {
         ikcp_segment_delete(kcp, newseg);
@@ -718,18 +857,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 #endif
 
     // move available data from rcv_buf -> rcv_queue
-    while (! iqueue_is_empty(&kcp->rcv_buf)) {
-        IKCPSEG *seg = iqueue_entry(kcp->rcv_buf.next, IKCPSEG, node);
-        if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
-            iqueue_del(&seg->node);
-            kcp->nrcv_buf--;
-            iqueue_add_tail(&seg->node, &kcp->rcv_queue);
-            kcp->nrcv_que++;
-            kcp->rcv_nxt++;
-        }	else {
-            break;
-        }
-    }
+    ikcp_move_rcv_buf(kcp);
 
 #if 0
     ikcp_qprint("queue", &kcp->rcv_queue);
@@ -931,7 +1059,7 @@ static int ikcp_wnd_unused(const ikcpcb *kcp)
 void ikcp_flush(ikcpcb *kcp)
 {
     IUINT32 current = kcp->current;
-    char *buffer = kcp->buffer;
+    char *buffer = kcp->outputv ? kcp->batch : kcp->buffer;
     char *ptr = buffer;
     int count, size, i;
     IUINT32 resent, cwnd;
@@ -958,7 +1086,7 @@ void ikcp_flush(ikcpcb *kcp)
     for (i = 0; i < count; i++) {
         size = (int)(ptr - buffer);
         if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
-            ikcp_output(kcp, buffer, size);
+            buffer = ikcp_output_push(kcp, buffer, size);
             ptr = buffer;
         }
         ikcp_ack_get(kcp, i, &seg.sn, &seg.ts);
@@ -994,7 +1122,7 @@ void ikcp_flush(ikcpcb *kcp)
         seg.cmd = IKCP_CMD_WASK;
         size = (int)(ptr - buffer);
         if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
-            ikcp_output(kcp, buffer, size);
+            buffer = ikcp_output_push(kcp, buffer, size);
             ptr = buffer;
         }
         ptr = ikcp_encode_seg(ptr, &seg);
@@ -1005,7 +1133,7 @@ void ikcp_flush(ikcpcb *kcp)
         seg.cmd = IKCP_CMD_WINS;
         size = (int)(ptr - buffer);
         if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
-            ikcp_output(kcp, buffer, size);
+            buffer = ikcp_output_push(kcp, buffer, size);
             ptr = buffer;
         }
         ptr = ikcp_encode_seg(ptr, &seg);
@@ -1024,8 +1152,14 @@ void ikcp_flush(ikcpcb *kcp)
 
         newseg = iqueue_entry(kcp->snd_queue.next, IKCPSEG, node);
 
+        if (kcp->snd_nxt - kcp->snd_una > kcp->snd_mask) {
+            ikcp_ring_grow(kcp, &kcp->snd_ring, &kcp->snd_mask, &kcp->snd_buf,
+                           kcp->snd_nxt - kcp->snd_una);
+        }
+
         iqueue_del(&newseg->node);
         iqueue_add_tail(&newseg->node, &kcp->snd_buf);
+        kcp->snd_ring[kcp->snd_nxt & kcp->snd_mask] = newseg;
         kcp->nsnd_que--;
         kcp->nsnd_buf++;
 
@@ -1090,7 +1224,7 @@ void ikcp_flush(ikcpcb *kcp)
             need = IKCP_OVERHEAD + segment->len;
 
             if (size + need > (int)kcp->mtu) {
-                ikcp_output(kcp, buffer, size);
+                buffer = ikcp_output_push(kcp, buffer, size);
                 ptr = buffer;
             }
 
@@ -1110,7 +1244,10 @@ void ikcp_flush(ikcpcb *kcp)
     // flash remain segments
     size = (int)(ptr - buffer);
     if (size > 0) {
-        ikcp_output(kcp, buffer, size);
+        ikcp_output_push(kcp, buffer, size);
+    }
+    if (kcp->outputv) {
+        ikcp_output_batch(kcp);
     }
 
     // update ssthresh
@@ -1228,6 +1365,10 @@ int ikcp_setmtu(ikcpcb *kcp, int mtu)
     buffer = (char*)ikcp_malloc((mtu + IKCP_OVERHEAD) * 3);
     if (buffer == NULL)
         return -2;
+    if (kcp->batch_buf && ikcp_batch_alloc(kcp, kcp->batch_max, mtu) < 0) {
+        ikcp_free(buffer);
+        return -2;
+    }
     kcp->mtu = mtu;
     kcp->mss = kcp->mtu - IKCP_OVERHEAD;
     ikcp_free(kcp->buffer);
@@ -303,6 +303,9 @@ struct IKCPCB
     struct IQUEUEHEAD rcv_queue;
     struct IQUEUEHEAD snd_buf;
     struct IQUEUEHEAD rcv_buf;
+    // segments of snd_buf/rcv_buf indexed by sn & mask, sized to the largest span seen
+    struct IKCPSEG **snd_ring, **rcv_ring;
+    IUINT32 snd_mask, rcv_mask;
     IUINT32 *acklist;
     IUINT32 ackcount;
     IUINT32 ackblock;
@@ -313,6 +316,12 @@ struct IKCPCB
     int nocwnd, stream;
     int logmask;
     int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
+    // batch output: datagrams of one flush are packed into 'batch' and handed over together
+    int (*outputv)(const char **bufs, const int *lens, int count, struct IKCPCB *kcp, void *user);
+    const char **batch_buf;
+    int *batch_len;
+    char *batch;
+    int batch_count, batch_max;
     void (*writelog)(const char *log, struct IKCPCB *kcp, void *user);
 };
 
@@ -352,6 +361,12 @@ void ikcp_release(ikcpcb *kcp);
 void ikcp_setoutput(ikcpcb *kcp, int (*output)(const char *buf, int len,
                                                ikcpcb *kcp, void *user));
 
+// set batch output callback, each flush hands its datagrams over in groups
+// of up to 'maxbatch' instead of one 'output' call per datagram.
+// 'outputv' NULL goes back to 'output', returns below zero on failure
+int ikcp_setoutputv(ikcpcb *kcp, int (*outputv)(const char **bufs, const int *lens,
+                                                int count, ikcpcb *kcp, void *user), int maxbatch);
+
 // user/upper level recv: returns size, returns below zero for EAGAIN
 int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 
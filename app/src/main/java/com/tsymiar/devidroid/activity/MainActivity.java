@@ -36,6 +36,9 @@ import com.tsymiar.devidroid.wrapper.CallbackWrapper;
 import com.tsymiar.devidroid.wrapper.NetWrapper;
 import com.tsymiar.devidroid.wrapper.TimeWrapper;
 
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.Charset;
 import java.util.Arrays;
 
 public class MainActivity extends AppCompatActivity implements EventHandle {
@@ -143,20 +146,24 @@ public class MainActivity extends AppCompatActivity implements EventHandle {
         publisherIntent = new Intent(MainActivity.this, PublishDialog.class);
 
         new Thread(() -> {
+            CallbackWrapper wrapper = new CallbackWrapper();
+            ByteBuffer buffer = ByteBuffer.allocateDirect(64 * 1024).order(ByteOrder.nativeOrder());
+            Charset utf8 = Charset.forName("UTF-8");
             do {
-                Receiver receiver = new Receiver();
-                CallbackWrapper wrapper = new CallbackWrapper();
-                receiver = wrapper.getMessage(receiver);
-                if (receiver != null && receiver.message != null) {
+                // one jni call for a whole burst of messages
+                int count = wrapper.drainMessages(buffer, 64);
+                buffer.clear();
+                for (int i = 0; i < count; i++) {
                     Message msg = new Message();
-                    msg.what = receiver.receiver;
-                    msg.obj = receiver.message;
+                    msg.what = buffer.getInt();
+                    byte[] bytes = new byte[buffer.getInt()];
+                    buffer.get(bytes);
+                    msg.obj = new String(bytes, utf8);
                     handler.sendMessage(msg);
                 }
-                try {
-                    Thread.sleep(100);
-                } catch (InterruptedException e) {
-                    e.printStackTrace();
+                if (count == 0) {
+                    // parked in native until setMessage, no polling while idle
+                    wrapper.waitMessages(1000);
                 }
             } while(true);
         }).start();
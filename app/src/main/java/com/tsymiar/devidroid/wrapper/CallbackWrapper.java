@@ -2,6 +2,8 @@ package com.tsymiar.devidroid.wrapper;
 
 import com.tsymiar.devidroid.data.Receiver;
 
+import java.nio.ByteBuffer;
+
 public class CallbackWrapper {
     static {
         System.loadLibrary("jniComm");
@@ -13,13 +15,37 @@ public class CallbackWrapper {
 
     public native Receiver getMessage(Receiver receiver);
 
+    // packs up to max messages into a direct buffer: int receiver, int length, utf-8 bytes
+    public native int drainMessages(ByteBuffer buffer, int max);
+
+    // blocks until a message is queued or timeoutMs passes, false on timeout
+    public native boolean waitMessages(int timeoutMs);
+
+    public static native void messageBenchmark(int rounds);
+
+    public static native void jniBenchmark(int rounds);
+
     public native long timeSetJNI(byte[] time, int len);
 
     public static native void callJavaMethod(String method, int action, String content, boolean statics);
 
     public static native int StartSubscribe(String address, int port, String topic, String viewId, int id);
 
+    // batched per topic, then queued onto a pooled broker connection; returns at once
     public static native void Publish(String topic, String payload);
 
+    // a batch goes out at maxBytes (256 at most) or deadlineMs after its first message;
+    // deadlineMs 0, the default, publishes every message on its own; payloads of a batch are joined by '\n'
+    public static native void setPublishBatching(int maxBytes, int deadlineMs);
+
+    // coalesce: a batch of this topic only publishes its newest payload
+    public static native void setPublishMode(String topic, boolean coalesce);
+
+    // batch sizes, flush latency and pool counters
+    public static native String publishStats();
+
+    // connect-per-message against pooled publishing to the subscribed broker, then batching
+    public static native void publishBenchmark(int count);
+
     public static native void QuitSubscribe();
 }
@@ -6,6 +6,22 @@ public class NetWrapper {
     }
     public static native int sendUdpData(String text, int len);
     public static native int startUdpServer();
+    public static native void setUdpFec(int data, int parity);
     public static native int startTcpServer(int port);
     public static native void KcpRun();
+    public static native int udpBenchmark(int count);
+    public static native int tcpBenchmark(int port, int clients);
+    public static native int startKcp(int localPort, String peerIp, int peerPort, int conv);
+    public static native int sendKcpData(String text);
+    public static native void stopKcp();
+    public static native int startKcpMux(int port, int maxSessions);
+    public static native void stopKcpMux();
+    public static native int kcpBenchmark(int count);
+    public static native void kcpSchedulerBenchmark();
+    public static native int kcpSweep(String dir);
+    public static native void kcpAllocatorBenchmark();
+    public static native void kcpMuxBenchmark(int sessions);
+    public static native void fecBenchmark(int data, int parity, double loss);
+    // seed 0 picks one from the clock
+    public static native void kcpRingCheck(int seed);
 }
@@ -2,12 +2,19 @@ package com.tsymiar.devidroid.wrapper;
 
 import android.graphics.SurfaceTexture;
 
+import java.nio.ByteBuffer;
+
 public class ViewWrapper {
 
     static {
         System.loadLibrary("jniComm");
     }
 
+    /* android.graphics.ImageFormat values accepted by submitFrame */
+    public static final int FRAME_NV21 = 0x11;
+    public static final int FRAME_I420 = 0x23;
+    public static final int FRAME_YV12 = 0x32315659;
+
     public static native void unloadSurfaceView();
 
     public static native void setRenderSize(int height, int width);
@@ -22,4 +29,25 @@ public class ViewWrapper {
 
     public static native void updateCpuSurface(SurfaceTexture tex);
 
+    /* frames pushed below are drawn on this texture, by OpenGL ES when gpu is set */
+    public static native boolean attachFrameSurface(SurfaceTexture tex, boolean gpu);
+
+    public static native void detachFrameSurface();
+
+    /* native frame buffers, reused for ever: acquireFrame an index (-1 while all are in flight),
+     * fill that buffer with a packed frame and submitFrame it, never touch it until acquired again.
+     * Buffers of an earlier call stay allocated but are no longer part of the ring, null while
+     * a frame is still in flight. */
+    public static native ByteBuffer[] allocateFrames(int count, int size);
+
+    public static native int acquireFrame();
+
+    public static native boolean submitFrame(int index, int width, int height, int format, long timestampNs);
+
+    /* draws direct buffers in place, e.g. the Image.Plane buffers of a camera or decoder image,
+     * and returns once they have been read */
+    public static native boolean renderFrame(ByteBuffer y, int yStride, ByteBuffer u, ByteBuffer v,
+                                             int uvStride, int uvPixelStride, int width, int height,
+                                             long timestampNs);
+
 }